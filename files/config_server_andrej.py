@@ -5,4 +5,5 @@ config = {
         "ORIGIN_DOMAIN_API": "api.perder.si",
         "REPO_DIR": "/usr/local/perdersi/repo_s",
         "TESTING": False,
+        "TESTING_TRUNCATE": "0",
 }
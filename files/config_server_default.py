@@ -5,4 +5,5 @@ config = {
         "ORIGIN_DOMAIN_API": "api.localhost.localdomain",
         "REPO_DIR": "./repo_s",
         "TESTING": False,
+        "TESTING_TRUNCATE": "0",
 }
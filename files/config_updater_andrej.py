@@ -1,9 +1,27 @@
 config = {
-        "LISTEN_PORT": "5201",
+        "LISTEN_PORT": "5200",
         "ORIGIN_DOMAIN_API": "api.perder.si",
         "REPO_DIR": "repo",
         "REPO_CHK_DIR": "repo_chk",
         "TESTING": False,
+        "UPDATER_CHECKOUT": "diff",
+        "UPDATER_CHECKOUT_FUSED": "0",
+        "UPDATER_CHECKOUT_THREADS": "4",
+        "UPDATER_CONNECT_TIMEOUT_MS": "10000",
+        "UPDATER_FETCH_CONNECTIONS": "4",
+        "UPDATER_GET_OBJECTS": "1",
+        "UPDATER_IO_THREADS": "1",
+        "UPDATER_IO_TIMEOUT_MS": "30000",
+        "UPDATER_MIRRORS": "",
+        "UPDATER_MIRROR_SPREAD": "2",
+        "UPDATER_PACK": "0",
+        "UPDATER_PIPELINE_WINDOW": "8",
+        "UPDATER_REQUEST_TIMEOUT_MS": "900000",
+        "UPDATER_RETRY_ATTEMPTS": "5",
+        "UPDATER_RETRY_BASE_MS": "250",
+        "UPDATER_RETRY_CAP_MS": "8000",
+        "UPDATER_SCHED": "critical",
+        "UPDATER_SCHED_LARGE": "1048576",
         "UPDATER_EXE_RELATIVE": "updater.exe",
         "UPDATER_STAGE2_EXE_RELATIVE": "stage2.exe",
 }
@@ -1,6 +1,8 @@
 import git
 import git.cmd
+import os
 import pathlib
+import struct
 import typing
 from argparse import ArgumentParser as argparse__ArgumentParser
 from git import Repo as git__Repo
@@ -10,6 +12,7 @@ from shutil import copy2 as shutil__copy2
 from shutil import copytree as shutil__copytree
 from shutil import rmtree as shutil__rmtree
 from subprocess import run as subprocess__run
+from typing import List, Tuple
 from sys import executable as sys__executable
 
 # https://github.com/gitpython-developers/GitPython/issues/292
@@ -39,6 +42,53 @@ def copy_fromdir_todir(srcdir: pathlib.Path, dstdir: pathlib.Path):
     for x in [pathlib__Path(a) for a in glob__glob(str(srcdir.joinpath('*')))]:
         copy_from_todir(src=x, dstdir=dstdir)
 
+MANIFEST_MAGIC = b"PSMF"
+MANIFEST_VERSION = 1
+MANIFEST_HEAD = struct.Struct("<4sIII20s4x")
+MANIFEST_RECORD = struct.Struct("<III20sQQ")
+
+def manifest_entries(repo: git.Repo, commit: git.Commit) -> List[Tuple[bytes, int, str, int, int]]:
+    ''' (path, mode, hex, size, compressed size) of the root tree and of every tree and blob below it, sorted by path (bytewise)
+        compressed size is that of the loose object (as served by /objects), 0 if packed '''
+    out: bytes = subprocess__run(["git", "ls-tree", "-r", "-t", "-z", "--full-tree", commit.hexsha], cwd=repo.git_dir, capture_output=True, check=True).stdout
+    entries = [(b"", 0o40000, commit.tree.hexsha)]
+    for rec in out.split(b"\0"):
+        if not rec:
+            continue
+        meta, path = rec.split(b"\t", 1)
+        mode, typ, hexsha = meta.decode("UTF-8").split()
+        if typ not in ("tree", "blob"):
+            continue
+        entries.append((path, int(mode, 8), hexsha))
+    check: bytes = subprocess__run(["git", "cat-file", "--batch-check=%(objectsize)"], cwd=repo.git_dir, input="".join([x[2] + "\n" for x in entries]).encode("UTF-8"), capture_output=True, check=True).stdout
+    sizes: List[int] = [int(x) for x in check.split()]
+    assert len(sizes) == len(entries)
+    objdir: pathlib.Path = pathlib__Path(repo.git_dir) / "objects"
+    def csize(hexsha: str):
+        try:
+            return (objdir / hexsha[:2] / hexsha[2:]).stat().st_size
+        except FileNotFoundError:
+            return 0
+    return sorted([(x[0], x[1], x[2], size, csize(x[2])) for x, size in zip(entries, sizes)])
+
+def manifest_write(repo: git.Repo, commit: git.Commit):
+    ''' binary manifest of commit at .git/manifest/(commit hex) - read by UpdaterManifest (psmanifest.hpp), the format is described there
+        one download gives the updater every tree and blob with its path and size, no tree walk '''
+    entries = manifest_entries(repo, commit)
+    paths: bytes = b"".join([x[0] for x in entries])
+    out: List[bytes] = [MANIFEST_HEAD.pack(MANIFEST_MAGIC, MANIFEST_VERSION, len(entries), len(paths), bytes.fromhex(commit.hexsha))]
+    offset: int = 0
+    for path, mode, hexsha, size, csize in entries:
+        out.append(MANIFEST_RECORD.pack(offset, len(path), mode, bytes.fromhex(hexsha), size, csize))
+        offset += len(path)
+    out.append(paths)
+    mandir: pathlib.Path = pathlib__Path(repo.git_dir) / "manifest"
+    mandir.mkdir(exist_ok=True)
+    tmp: pathlib.Path = mandir / (commit.hexsha + ".tmp")
+    with open(str(tmp), "wb") as f:
+        f.write(b"".join(out))
+    os.replace(str(tmp), str(mandir / commit.hexsha))
+
 def run():
     # get args
     parser = argparse__ArgumentParser()
@@ -59,6 +109,8 @@ def run():
     # repo add files and commit
     repo.git.add(A=True)
     commit: git.Commit = repo.index.commit('ccc')
+    # manifest before the ref - a client seeing the commit finds its manifest
+    manifest_write(repo, commit)
     # repo set ref
     ref = git.Reference(repo, refname)
     ref.set_object(commit)
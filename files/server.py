@@ -10,7 +10,13 @@ import git
 from os import (name as os_name,
                 urandom as os_urandom)
 import pathlib
+from random import (random as random_random,
+                    randrange as random_randrange)
 from pathlib import (Path as pathlib_Path)
+from re import (fullmatch as re_fullmatch)
+import subprocess
+from subprocess import (Popen as subprocess_Popen,
+                        run as subprocess_run)
 import urllib.parse
 from werkzeug.wsgi import (wrap_file as werkzeug_wsgi_wrap_file)
 
@@ -71,6 +77,9 @@ def server_repo_ctx_teardown(err):
 def server_route_api_post(path):
     return server_app.route(path, subdomain="api", methods=["POST"])
 
+def server_route_api_get(path):
+    return server_app.route(path, subdomain="api", methods=["GET"])
+
 @server_route_api_post("/refs/heads/<refname>")
 def refs_heads(refname):
     ref = git.Reference(server_repo_ctx_get().repo, "refs/heads/" + refname)
@@ -79,15 +88,149 @@ def refs_heads(refname):
     #return flask_jsonify({ "tree": tree.hexsha })
     return tree.hexsha
 
-@server_route_api_post("/objects/<objhex_a>/<objhex_b>")
-def object(objhex_a, objhex_b):
+def server_range_start(size: int):
+    ''' start of a "Range: bytes=(start)-" request, None to send the whole body
+        a start at or past the end is ignored (whole body) - the client then restarts its partial copy '''
+    m = re_fullmatch("bytes=([0-9]+)-", flask_request.headers.get("Range", ""))
+    if not m or int(m.group(1)) >= size:
+        return None
+    return int(m.group(1))
+
+def server_truncate_body(f, size: int):
+    ''' testing - stop after a random prefix of the body, the client sees the connection drop short of Content-Length '''
+    remaining = random_randrange(size)
+    while remaining:
+        data = f.read(min(remaining, 65536))
+        if not data:
+            break
+        remaining -= len(data)
+        yield data
+    f.close()
+
+def server_object_response(objhex_a: str, objhex_b: str, headers: dict):
+    ''' loose object file - resumable with Range (206 from the requested offset) '''
+    if not re_fullmatch("[0-9a-fA-F]{2}", objhex_a) or not re_fullmatch("[0-9a-fA-F]{38}", objhex_b):
+        flask.abort(404)
     repopath: pathlib.Path = server_repo_ctx_get().repodir
     objectpath: pathlib.Path = repopath / ".git" / "objects" / objhex_a / objhex_b
+    # not here - a client error, so not retried or failed over (see UpdaterFetchPool::_retryable)
+    try:
+        size: int = objectpath.stat().st_size
+    except FileNotFoundError:
+        flask.abort(404)
+    start = server_range_start(size)
+    f = open(str(objectpath), mode="rb")
+    if start is not None:
+        f.seek(start)
+        headers["Content-Range"] = "bytes " + str(start) + "-" + str(size - 1) + "/" + str(size)
+    headers["Content-Length"] = str(size - (start or 0))
+    truncate: float = float(flask_current_app.config['PS'].get("TESTING_TRUNCATE", "0"))
+    body = server_truncate_body(f, size - (start or 0)) if size - (start or 0) and random_random() < truncate else werkzeug_wsgi_wrap_file(flask_request.environ, f)
     return flask_current_app.response_class(
-        werkzeug_wsgi_wrap_file(flask_request.environ, open(str(objectpath), mode="rb")),
+        body,
+        status=(206 if start is not None else 200),
+        headers=headers,
         content_type="application/octet-stream",
         direct_passthrough=True)
 
+@server_route_api_post("/objects/<objhex_a>/<objhex_b>")
+def object(objhex_a, objhex_b):
+    return server_object_response(objhex_a, objhex_b, {})
+
+@server_route_api_get("/objects/<objhex_a>/<objhex_b>")
+def object_get(objhex_a, objhex_b):
+    ''' as object, cacheable - a loose object never changes, its name is its content hash
+        ETag is the OID, If-None-Match of it answers 304 without the body (caches in front revalidating) '''
+    etag: str = '"' + (objhex_a + objhex_b).lower() + '"'
+    headers = {
+        "ETag": etag,
+        "Cache-Control": "public, max-age=31536000, immutable",
+        "Accept-Ranges": "bytes",
+    }
+    inm = [x.strip() for x in flask_request.headers.get("If-None-Match", "").split(",")]
+    if etag in inm or "*" in inm:
+        return flask_current_app.response_class(status=304, headers=headers)
+    return server_object_response(objhex_a, objhex_b, headers)
+
+@server_route_api_post("/manifest/<objhex>")
+def manifest(objhex):
+    ''' binary manifest of commit objhex (see manifest_write of coor.py) - 404 for commits published without one '''
+    if not re_fullmatch("[0-9a-fA-F]{40}", objhex):
+        flask.abort(404)
+    manifestpath: pathlib.Path = server_repo_ctx_get().repodir / ".git" / "manifest" / objhex.lower()
+    if not manifestpath.is_file():
+        flask.abort(404)
+    return flask_current_app.response_class(
+        manifestpath.read_bytes(),
+        content_type="application/octet-stream")
+
+class PackExc(Exception):
+        pass
+
+def server_revs_from_request(objhex: str):
+    ''' rev-list style revisions: objhex but not the haves
+        haves are posted as the request body, one hex per line - 400 if any is not a hex '''
+    haves = flask_request.get_data().decode("UTF-8").split()
+    for x in [objhex] + haves:
+        if not re_fullmatch("[0-9a-fA-F]{40}", x):
+            flask.abort(400)
+    return "".join([objhex + "\n"] + ["^" + x + "\n" for x in haves])
+
+def server_pack_body(p0: subprocess.Popen, first: bytes):
+    ''' stdout of pack-objects p0 (first already read), the child reaped once it is exhausted
+        a failing pack-objects cuts the response short - the client's indexer sees a truncated pack, not a complete looking one '''
+    try:
+        yield first
+        for data in iter(lambda: p0.stdout.read(65536), b""):
+            yield data
+    finally:
+        p0.stdout.close()
+        returncode: int = p0.wait()
+    if returncode != 0:
+        raise PackExc()
+
+@server_route_api_post("/pack/<objhex>")
+def pack(objhex):
+    ''' packfile of everything reachable from objhex but not from the haves
+        404 if pack-objects fails before any output (objhex or a have unknown) '''
+    revs: str = server_revs_from_request(objhex)
+    p0 = subprocess_Popen(["git", "pack-objects", "--revs", "--stdout", "-q"], cwd=str(server_repo_ctx_get().repodir), stdin=subprocess.PIPE, stdout=subprocess.PIPE)
+    p0.stdin.write(revs.encode("UTF-8"))
+    p0.stdin.close()
+    first: bytes = p0.stdout.read(65536)
+    if not first:
+        p0.stdout.close()
+        p0.wait()
+        flask.abort(404)
+    return flask_current_app.response_class(
+        server_pack_body(p0, first),
+        content_type="application/x-git-packed-objects",
+        direct_passthrough=True)
+
+@server_route_api_post("/delta/<objhex>")
+def delta(objhex):
+    ''' list of the objects reachable from objhex but not from the haves, one hex per line
+        404 if objhex or a have is unknown (history rewritten since the client installed it) - the client falls back to a full walk '''
+    revs: str = server_revs_from_request(objhex)
+    p0: subprocess.CompletedProcess = subprocess_run(["git", "rev-list", "--objects", "--stdin"], cwd=str(server_repo_ctx_get().repodir), input=revs, timeout=300, capture_output=True, text=True)
+    if p0.returncode != 0:
+        flask.abort(404)
+    return "".join([x[:40] + "\n" for x in p0.stdout.splitlines() if x])
+
+@server_route_api_post("/sizes/")
+def sizes():
+    ''' size in bytes of each posted object as served by /objects (loose, compressed), one "hex size" per line
+        objects are posted as the request body, one hex per line - 400 if any is not a hex, 404 if any is not served '''
+    repopath: pathlib.Path = server_repo_ctx_get().repodir
+    objs = flask_request.get_data().decode("UTF-8").split()
+    for x in objs:
+        if not re_fullmatch("[0-9a-fA-F]{40}", x):
+            flask.abort(400)
+    paths = [repopath / ".git" / "objects" / x[:2] / x[2:] for x in objs]
+    if not all(x.is_file() for x in paths):
+        flask.abort(404)
+    return "".join([x + " " + str(y.stat().st_size) + "\n" for x, y in zip(objs, paths)])
+
 @server_route_api_post("/sub/")
 def qqq():
     server_check_csrf()
@@ -2,6 +2,7 @@ import flask.testing
 import git
 from git.objects.fun import (tree_entries_from_data as git_objects_fun_tree_entries_from_data)
 from gitdb.db.loose import (LooseObjectDB as gitdb_db_loose_LooseObjectDB)
+import coor
 from importlib import (import_module as importlib_import_module)
 from json import (dumps as json_dumps,
                   loads as json_loads)
@@ -37,6 +38,8 @@ class RetCodeErr(Exception):
     pass
 class RetCode500(RetCodeErr):
     pass
+class RetCode4xx(RetCodeErr):
+    pass
 
 class Dirs:
     def __init__(self, tmpbase: str):
@@ -116,7 +119,9 @@ def _req_post(
     rv = client.post(base_url="http://api.localhost.localdomain:5201", path=path, data=data, **kwargs)
     if rv.status_code == 500:
         raise RetCode500()
-    if rv.status_code != 200:
+    if 400 <= rv.status_code < 500:
+        raise RetCode4xx()
+    if rv.status_code not in (200, 206):
         raise RetCodeErr()
     return rv
 
@@ -242,6 +247,65 @@ def test_get_head_object(
     treedata: bytes = zlib_decompress(master_tree_loose)
     assert treedata.find(b"tree") != -1 and treedata.find(b"a.txt") != -1
 
+def test_get_head_object_range(
+    client: flask.testing.FlaskClient
+):
+    master_tree: shahex = _get_master_tree_hex(client)
+    master_tree_loose = _get_object(client, master_tree)
+    rv = _req_post(client, "/objects/" + master_tree[:2] + "/" + master_tree[2:], "", headers={"Range": "bytes=3-"})
+    assert rv.status_code == 206 and rv.data == master_tree_loose[3:]
+    assert rv.headers["Content-Range"] == "bytes 3-" + str(len(master_tree_loose) - 1) + "/" + str(len(master_tree_loose))
+    # past the end - whole body
+    rv = _req_post(client, "/objects/" + master_tree[:2] + "/" + master_tree[2:], "", headers={"Range": "bytes=" + str(len(master_tree_loose)) + "-"})
+    assert rv.status_code == 200 and rv.data == master_tree_loose
+
+def test_get_head_object_truncate(
+    client: flask.testing.FlaskClient
+):
+    master_tree: shahex = _get_master_tree_hex(client)
+    master_tree_loose = _get_object(client, master_tree)
+    server_app.config['PS']['TESTING_TRUNCATE'] = "1"
+    try:
+        rv = _req_post(client, "/objects/" + master_tree[:2] + "/" + master_tree[2:], "")
+    finally:
+        server_app.config['PS']['TESTING_TRUNCATE'] = "0"
+    assert len(rv.data) < len(master_tree_loose) and master_tree_loose.startswith(rv.data)
+    # resume
+    if len(rv.data):
+        rv2 = _req_post(client, "/objects/" + master_tree[:2] + "/" + master_tree[2:], "", headers={"Range": "bytes=" + str(len(rv.data)) + "-"})
+        assert rv.data + rv2.data == master_tree_loose
+    else:
+        rv2 = _req_post(client, "/objects/" + master_tree[:2] + "/" + master_tree[2:], "")
+        assert rv2.data == master_tree_loose
+
+def test_get_object_cacheable(
+    client: flask.testing.FlaskClient
+):
+    master_tree: shahex = _get_master_tree_hex(client)
+    master_tree_loose = _get_object(client, master_tree)
+    path: str = "/objects/" + master_tree[:2] + "/" + master_tree[2:]
+    rv = client.get(base_url="http://api.localhost.localdomain:5201", path=path)
+    assert rv.status_code == 200 and rv.data == master_tree_loose
+    assert rv.headers["ETag"] == '"' + master_tree + '"'
+    assert "immutable" in rv.headers["Cache-Control"]
+    # revalidation - no body
+    rv = client.get(base_url="http://api.localhost.localdomain:5201", path=path, headers={"If-None-Match": '"' + master_tree + '"'})
+    assert rv.status_code == 304 and rv.data == b""
+    rv = client.get(base_url="http://api.localhost.localdomain:5201", path=path, headers={"Range": "bytes=3-"})
+    assert rv.status_code == 206 and rv.data == master_tree_loose[3:]
+    # not an object name
+    rv = client.get(base_url="http://api.localhost.localdomain:5201", path="/objects/../" + master_tree[2:])
+    assert rv.status_code == 404
+
+def test_get_object_unknown(
+    client: flask.testing.FlaskClient
+):
+    unknown: shahex = "0" * 40
+    with pytest.raises(RetCode4xx):
+        _req_post(client, "/objects/" + unknown[:2] + "/" + unknown[2:], "")
+    rv = client.get(base_url="http://api.localhost.localdomain:5201", path="/objects/" + unknown[:2] + "/" + unknown[2:])
+    assert rv.status_code == 404
+
 def test_get_head_trees(
     rc: ServerRepoCtx,
     client: flask.testing.FlaskClient
@@ -264,6 +328,78 @@ def test_get_head_blobs(
     _get_blobs(client, rc.repo.odb, blobs)
     assert len(blobs) == 4
 
+def test_get_head_pack(
+    rc_s: ServerRepoCtx,
+    client: flask.testing.FlaskClient
+):
+    master: git.Reference = git.Reference(rc_s.repo, "refs/heads/master")
+    rv = _req_post(client, "/pack/" + master.commit.hexsha, "")
+    assert rv.data[:4] == b"PACK"
+    # everything reachable from the commit is already had - nothing but the commit itself
+    rv = _req_post(client, "/pack/" + master.commit.hexsha, master.commit.tree.hexsha + "\n")
+    assert rv.data[:4] == b"PACK" and int.from_bytes(rv.data[8:12], "big") == 1
+    # pack-objects failing (unknown have) - an error status, not an empty 200
+    with pytest.raises(RetCode4xx):
+        _req_post(client, "/pack/" + master.commit.hexsha, "0" * 40 + "\n")
+
+def test_get_head_delta(
+    rc_s: ServerRepoCtx,
+    client: flask.testing.FlaskClient
+):
+    master: git.Reference = git.Reference(rc_s.repo, "refs/heads/master")
+    rv = _req_post(client, "/delta/" + master.commit.hexsha, "")
+    assert len(rv.data.decode("UTF-8").split()) == 6
+    rv = _req_post(client, "/delta/" + master.commit.hexsha, master.commit.tree.hexsha + "\n")
+    assert rv.data.decode("UTF-8").split() == [master.commit.hexsha]
+    # unknown have (history rewritten) - a client error, not retried, the client falls back to a full walk
+    with pytest.raises(RetCode4xx):
+        _req_post(client, "/delta/" + master.commit.hexsha, "0" * 40 + "\n")
+    with pytest.raises(RetCode4xx):
+        _req_post(client, "/delta/" + master.commit.hexsha, "zz\n")
+
+def test_get_head_sizes(
+    rc_s: ServerRepoCtx,
+    client: flask.testing.FlaskClient
+):
+    master: git.Reference = git.Reference(rc_s.repo, "refs/heads/master")
+    objs: List[shahex] = [master.commit.hexsha, master.commit.tree.hexsha]
+    rv = _req_post(client, "/sizes/", "".join([x + "\n" for x in objs]))
+    lines: List[List[str]] = [x.split() for x in rv.data.decode("UTF-8").splitlines()]
+    assert [x[0] for x in lines] == objs
+    for x in lines:
+        assert int(x[1]) == len(_get_object(client, x[0]))
+    with pytest.raises(RetCode4xx):
+        _req_post(client, "/sizes/", "zz\n")
+    with pytest.raises(RetCode4xx):
+        _req_post(client, "/sizes/", "0" * 40 + "\n")
+
+def test_get_head_manifest(
+    rc_s: ServerRepoCtx,
+    client: flask.testing.FlaskClient
+):
+    master: git.Reference = git.Reference(rc_s.repo, "refs/heads/master")
+    # published without one
+    with pytest.raises(RetCodeErr):
+        _req_post(client, "/manifest/" + master.commit.hexsha, "")
+    coor.manifest_write(rc_s.repo, master.commit)
+    rv = _req_post(client, "/manifest/" + master.commit.hexsha, "")
+    magic, version, count, pathsz, commit = coor.MANIFEST_HEAD.unpack_from(rv.data, 0)
+    assert magic == coor.MANIFEST_MAGIC and version == coor.MANIFEST_VERSION and commit.hex() == master.commit.hexsha
+    assert len(rv.data) == coor.MANIFEST_HEAD.size + count * coor.MANIFEST_RECORD.size + pathsz
+    paths = coor.MANIFEST_HEAD.size + count * coor.MANIFEST_RECORD.size
+    entries = {}
+    for i in range(count):
+        off, n, mode, oid, size, csize = coor.MANIFEST_RECORD.unpack_from(rv.data, coor.MANIFEST_HEAD.size + i * coor.MANIFEST_RECORD.size)
+        entries[rv.data[paths + off:paths + off + n]] = (mode, oid.hex(), size, csize)
+    assert list(entries.keys()) == sorted(entries.keys())
+    assert set(entries.keys()) == {b"", b"a.txt", b"d", b"d/b.txt", b"stage2.exe", b"updater.exe"}
+    assert entries[b""][:2] == (PS_GIT_FILEMODE_TREE, master.commit.tree.hexsha)
+    assert entries[b"a.txt"][0] == PS_GIT_FILEMODE_BLOB and entries[b"a.txt"][2] == 3
+    for mode, obj, size, csize in entries.values():
+        assert csize == len(_get_object(client, obj))
+    with pytest.raises(RetCodeErr):
+        _req_post(client, "/manifest/zz", "")
+
 def test_commit_head(
     rc: ServerRepoCtx,
     client: flask.testing.FlaskClient
@@ -319,10 +455,12 @@ def test_updater(
     updater_exe: pathlib.Path = dirs.updaterdir / 'updater.exe'
     shutil.copyfile(customopt_updater_exe, str(updater_exe))
     
+    # no nginx cache in front of the test server - talk to flask directly
     p0 = subprocess.Popen([str(updater_exe)], env=_testing_make_config(
         mod="updater",
         extra={
             "DEBUG_WAIT": customopt_debug_wait,
+            "LISTEN_PORT": importlib_import_module("ps_config_server").config["LISTEN_PORT"],
             "REPO_DIR": str(dirs.repodir_updater),
             "REPO_CHK_DIR": str(dirs.repodir_updater_chk),
         }))
@@ -0,0 +1,72 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <git2.h>
+
+#include <psgit.hpp>
+#include <psmisc.hpp>
+#include <psupdater.hpp>
+
+using namespace ps;
+
+/* existence checks per second
+     reopened odb - git_odb_open per check, every pack index found again
+     per-check odb - odb_from_repo per check (as before UpdaterSession) - libgit2 caches the odb in the repository,
+       so this only costs the refcount, not a rescan
+     session odb - the one odb of UpdaterSession
+     benchodb <repodir> [rounds]
+   every object of the repository is checked, point it at a repository with many packs */
+
+unique_ptr_gitodb
+odb_reopen(git_repository *repo)
+{
+	git_odb *odb = nullptr;
+	if (!!git_odb_open(&odb, (boost::filesystem::path(git_repository_path(repo)) / "objects").string().c_str()))
+		throw std::runtime_error("odb open");
+	return unique_ptr_gitodb(odb, odb_delete);
+}
+
+int collect_cb(const git_oid *id, void *payload)
+{
+	((std::vector<oid_t> *) payload)->push_back(git_bin2oidt(*id));
+	return 0;
+}
+
+template<typename F>
+double bench(const char *name, const std::vector<oid_t> &objs, size_t rounds, F f)
+{
+	const auto beg = std::chrono::steady_clock::now();
+	size_t n = 0;
+	for (size_t r = 0; r < rounds; r++)
+		for (const auto &obj : objs)
+			n += f(obj);
+	const double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+	if (n != objs.size() * rounds)
+		throw std::runtime_error("bench exists");
+	std::cout << name << ": " << (objs.size() * rounds / sec) << " checks/s" << std::endl;
+	return sec;
+}
+
+int main(int argc, char **argv)
+{
+	git_libgit2_init();
+
+	if (argc < 2)
+		throw std::runtime_error("usage: benchodb <repodir> [rounds]");
+	const size_t rounds = argc > 2 ? std::stoul(argv[2]) : 1;
+
+	UpdaterSession sess(argv[1]);
+	std::vector<oid_t> objs;
+	if (!!git_odb_foreach(sess.m_odb.get(), collect_cb, &objs))
+		throw std::runtime_error("odb foreach");
+	std::cout << "objects: " << objs.size() << std::endl;
+
+	bench("reopened odb", objs, rounds, [&](const oid_t &obj) { return git_odb_exists(odb_reopen(sess.m_repo.get()).get(), git_oidt2bin(obj)); });
+	bench("per-check odb", objs, rounds, [&](const oid_t &obj) { return git_odb_exists(odb_from_repo(sess.m_repo.get()).get(), git_oidt2bin(obj)); });
+	bench("session odb", objs, rounds, [&](const oid_t &obj) { return sess.exists(obj); });
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,76 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/regex.hpp>
+
+#include <git2.h>
+
+#include <pscon.hpp>
+#include <psgit.hpp>
+#include <psmisc.hpp>
+
+using namespace ps;
+
+/* per-object parsing throughput - regex compiled per call (as before) vs hand parsers
+     benchparse [rounds]
+   covers ConProgress::onRequest and the loose object header (GitObjectDataInfo) */
+
+template<typename F>
+void bench(const char *name, size_t n, F f)
+{
+	const auto beg = std::chrono::steady_clock::now();
+	size_t sum = 0;
+	for (size_t i = 0; i < n; i++)
+		sum += f(i);
+	const double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - beg).count();
+	if (sum != n)
+		throw std::runtime_error("bench parse");
+	std::cout << name << ": " << (n / sec) << " /s" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+	const size_t rounds = argc > 1 ? std::stoul(argv[1]) : 100000;
+
+	std::vector<std::string> paths, hdrs;
+	for (size_t i = 0; i < 1024; i++) {
+		oid_t obj;
+		for (size_t j = 0; j < oid_t::RAWSZ; j++)
+			obj.m_id[j] = (unsigned char) (i * 31 + j * 7);
+		const std::string hex = obj.hex();
+		paths.push_back("/objects/" + hex.substr(0, 2) + "/" + hex.substr(2));
+		hdrs.push_back(std::string(i % 2 ? "blob " : "tree ") + std::to_string(i * 977) + std::string(1, '\0') + "data");
+	}
+
+	bench("onRequest regex", rounds, [&](size_t i) {
+		boost::cmatch what;
+		if (!boost::regex_search(paths[i % paths.size()].c_str(), what, boost::regex("/objects/([[:xdigit:]]{2})/([[:xdigit:]]{38})"), boost::match_default))
+			return 0;
+		return (int) (oid_t::fromhex(what[1].str() + what[2].str()) != oid_t());
+	});
+	bench("onRequest hand", rounds, [&](size_t i) {
+		oid_t obj;
+		return (int) con_objpath_parse(paths[i % paths.size()], &obj);
+	});
+	ConProgress prog;
+	bench("onRequest", rounds, [&](size_t i) {
+		prog.onRequest(paths[i % paths.size()], "");
+		return 1;
+	});
+	if (prog.m_objects_requested.load() != rounds)
+		throw std::runtime_error("bench onRequest");
+
+	bench("header regex", rounds, [&](size_t i) {
+		boost::cmatch what(cruft_regex_search("([[:alpha:]]+) ([[:digit:]]+)", hdrs[i % hdrs.size()]));
+		return (int) (what[1].length() == 4);
+	});
+	bench("header hand", rounds, [&](size_t i) {
+		const GitObjectDataInfo odi(hdrs[i % hdrs.size()], git_tag_incoming_data_t());
+		return (int) (odi.m_type.size() == 4);
+	});
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,72 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include <pscon.hpp>
+#include <psmisc.hpp>
+
+using namespace ps;
+
+/* object requests per second against a running server (objserv or server.py)
+     benchserv <host> <port> <repodir> [nconn] [seconds] [get]
+   repodir is the .git directory the server serves - its loose objects are requested at random, nconn connections each on a thread
+   get - requests with GET (cacheable route) instead of POST */
+
+std::vector<std::string> objpaths_list(const boost::filesystem::path &gitdir)
+{
+	std::vector<std::string> paths;
+	for (boost::filesystem::directory_iterator it(gitdir / "objects"); it != boost::filesystem::directory_iterator(); ++it) {
+		const std::string a = it->path().filename().string();
+		if (a.size() != 2 || !boost::filesystem::is_directory(it->path()))
+			continue;
+		for (boost::filesystem::directory_iterator it2(it->path()); it2 != boost::filesystem::directory_iterator(); ++it2)
+			if (it2->path().filename().string().size() == 38)
+				paths.push_back("/objects/" + a + "/" + it2->path().filename().string());
+	}
+	return paths;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 4)
+		throw std::runtime_error("usage: benchserv <host> <port> <repodir> [nconn] [seconds] [get]");
+	const size_t nconn = argc > 4 ? std::stoul(argv[4]) : 8;
+	const double seconds = argc > 5 ? std::stod(argv[5]) : 5;
+	const bool get = argc > 6 && std::string(argv[6]) == "get";
+
+	const std::vector<std::string> paths(objpaths_list(argv[3]));
+	if (paths.empty())
+		throw std::runtime_error("no loose objects");
+	std::cout << "objects: " << paths.size() << " connections: " << nconn << (get ? " GET" : " POST") << std::endl;
+
+	std::atomic<uint64_t> nreq(0), nbytes(0), nerr(0);
+	const auto end = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+	std::vector<std::thread> thrs;
+	for (size_t i = 0; i < nconn; i++)
+		thrs.push_back(std::thread([&, i]() {
+			std::mt19937 rng((unsigned) i);
+			ConNet con(argv[1], argv[2], "", 1, ConTimeouts(), ConRetry(), get);
+			while (std::chrono::steady_clock::now() < end) {
+				try {
+					nbytes += con.reqPost(paths[rng() % paths.size()], "").body().size();
+					nreq++;
+				}
+				catch (std::exception &) {
+					nerr++;
+				}
+			}
+		}));
+	for (auto &t : thrs)
+		t.join();
+
+	std::cout << "requests/s: " << (nreq / seconds) << " MiB/s: " << (nbytes / seconds / (1024 * 1024)) << " errors: " << nerr << std::endl;
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,30 @@
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <psserv.hpp>
+#include <psupdater.hpp>
+
+using namespace ps;
+
+/* serves the objects and refs of a repository the way server.py does - the updater fetch path without python in it
+     objserv --repodir <.git dir> --host <listen host> --port <listen port> [--threads <n>] [--cache-mib <n>]
+   --cache-mib - memory for hot objects (default 256, 0 disables), its counters at /stats/cache
+   run behind nginx in place of the /objects/ upstream (see ps_serv.conf), delta lists / packs / sizes stay with server.py */
+
+int main(int argc, char **argv)
+{
+	const std::vector<std::string> args(updater_argv_vectorize(argc, argv));
+	const bool has_threads = std::find(args.begin(), args.end(), "--threads") != args.end();
+	const size_t nthreads = has_threads ? std::stoul(updater_argv_find_opt_arg(args, "--threads")) : std::max<size_t>(std::thread::hardware_concurrency(), 1);
+	const bool has_cache = std::find(args.begin(), args.end(), "--cache-mib") != args.end();
+	const size_t cache_mib = has_cache ? std::stoul(updater_argv_find_opt_arg(args, "--cache-mib")) : 256;
+
+	ServServer serv(updater_argv_find_opt_arg(args, "--host"), updater_argv_find_opt_arg(args, "--port"), updater_argv_find_opt_arg(args, "--repodir"), nthreads, cache_mib * 1024 * 1024);
+	std::cout << "objserv: " << serv.m_acceptor.local_endpoint() << " threads " << nthreads << " cache MiB " << cache_mib << std::endl;
+	serv.run();
+
+	return EXIT_SUCCESS;
+}
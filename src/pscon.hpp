@@ -1,17 +1,27 @@
 #ifndef _Con_HPP_
 #define _Con_HPP_
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <limits>
 #include <mutex>
-#include <set>
+#include <random>
 #include <string>
+#include <thread>
 #include <vector>
 #include <stdexcept>
 
 #include <boost/algorithm/string.hpp>
 #include <boost/beast.hpp>
 #include <boost/filesystem.hpp>
-#include <boost/regex.hpp>
 
 #include <psasio.hpp>
 #include <pscruft.hpp>
@@ -34,105 +44,509 @@ public:
 	{}
 };
 
-class con_tag_ratio_t {};
+/* unexpected HTTP status - server side (5xx) ones may pass on retry */
+class ConExcStatus : public ConExc
+{
+public:
+	inline ConExcStatus(int status) :
+		ConExc(),
+		m_status(status)
+	{}
+
+	int m_status;
+};
+
+/* zero is no limit
+     connect - resolve plus connect
+     io - longest a single read or write may go without completing (a stalled socket)
+     request - a whole request, first write to last byte of the response */
+class ConTimeouts
+{
+public:
+	inline ConTimeouts(std::chrono::milliseconds connect = std::chrono::milliseconds(0), std::chrono::milliseconds io = std::chrono::milliseconds(0), std::chrono::milliseconds request = std::chrono::milliseconds(0)) :
+		m_connect(connect),
+		m_io(io),
+		m_request(request)
+	{}
+
+	std::chrono::milliseconds m_connect;
+	std::chrono::milliseconds m_io;
+	std::chrono::milliseconds m_request;
+};
+
+/* exponential backoff with full jitter
+     attempt n (1-based) failing waits uniformly in [0, min(cap, base * 2^(n-1))] before attempt n+1
+   m_attempts counts the first attempt - one means no retry */
+class ConRetry
+{
+public:
+	inline ConRetry(size_t attempts = 1, std::chrono::milliseconds base = std::chrono::milliseconds(250), std::chrono::milliseconds cap = std::chrono::milliseconds(8000)) :
+		m_attempts(std::max<size_t>(attempts, 1)),
+		m_base(base),
+		m_cap(cap)
+	{}
+
+	inline std::chrono::milliseconds delay(size_t attempt) const
+	{
+		thread_local std::mt19937_64 rng(std::random_device{}());
+		const double ceil = std::min<double>((double) m_cap.count(), (double) m_base.count() * std::pow(2.0, (double) std::min<size_t>(attempt - 1, 62)));
+		return std::chrono::milliseconds(std::uniform_int_distribution<int64_t>(0, (int64_t) ceil)(rng));
+	}
+
+	inline void backoff(size_t attempt) const { std::this_thread::sleep_for(delay(attempt)); }
+
+	size_t m_attempts;
+	std::chrono::milliseconds m_base;
+	std::chrono::milliseconds m_cap;
+};
+
+inline ConTimeouts
+con_timeouts_from_config(const pt_t &config)
+{
+	return ConTimeouts(
+		std::chrono::milliseconds(config.get<int64_t>("UPDATER_CONNECT_TIMEOUT_MS", 0)),
+		std::chrono::milliseconds(config.get<int64_t>("UPDATER_IO_TIMEOUT_MS", 0)),
+		std::chrono::milliseconds(config.get<int64_t>("UPDATER_REQUEST_TIMEOUT_MS", 0)));
+}
 
+inline ConRetry
+con_retry_from_config(const pt_t &config)
+{
+	return ConRetry(
+		config.get<size_t>("UPDATER_RETRY_ATTEMPTS", 1),
+		std::chrono::milliseconds(config.get<int64_t>("UPDATER_RETRY_BASE_MS", 250)),
+		std::chrono::milliseconds(config.get<int64_t>("UPDATER_RETRY_CAP_MS", 8000)));
+}
+
+/* find "/objects/(xx)/(38 hex)" in path - parsed by hand, runs for every object requested */
+inline bool
+con_objpath_parse(const std::string &path, oid_t *obj)
+{
+	const std::string pfx = "/objects/";
+	const size_t len = pfx.size() + 2 + 1 + 38;
+	for (size_t pos = path.find(pfx); pos != std::string::npos; pos = path.find(pfx, pos + 1)) {
+		if (path.size() - pos < len || path[pos + pfx.size() + 2] != '/')
+			continue;
+		const std::string hex = path.substr(pos + pfx.size(), 2) + path.substr(pos + pfx.size() + 3, 38);
+		if (hex.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos)
+			continue;
+		*obj = oid_t::fromhex(hex);
+		return true;
+	}
+	return false;
+}
+
+/* snapshot of ConProgress counters */
 class ConEst
 {
 public:
-	inline ConEst(float a, float b, con_tag_ratio_t) :
-		m_r_a(a),
-		m_r_b(b)
+	inline ConEst() :
+		m_objects_listed(),
+		m_objects_missing(),
+		m_objects_total(),
+		m_objects_requested(),
+		m_objects_received(),
+		m_objects_verified(),
+		m_objects_written(),
+		m_bytes_total(),
+		m_bytes_received(),
+		m_bytes_resumed(),
+		m_bytes_written(),
+		m_retries(),
+		m_timeouts()
 	{}
 
-	float m_r_a, m_r_b;
+	/* byte-weighted once sizes are known - one large blob dominates the wait, not the many small ones */
+	inline float ratio() const
+	{
+		if (m_bytes_total)
+			return (float) m_bytes_written / m_bytes_total;
+		return m_objects_total ? (float) m_objects_written / m_objects_total : 0.0f;
+	}
+
+	/* objects the update needs, and how many of those were not already present locally */
+	uint64_t m_objects_listed;
+	uint64_t m_objects_missing;
+	uint64_t m_objects_total;
+	uint64_t m_objects_requested;
+	uint64_t m_objects_received;
+	uint64_t m_objects_verified;
+	uint64_t m_objects_written;
+	uint64_t m_bytes_total;
+	uint64_t m_bytes_received;
+	uint64_t m_bytes_resumed;
+	uint64_t m_bytes_written;
+	uint64_t m_retries;
+	uint64_t m_timeouts;
 };
 
+/* written by the download threads, read by the render thread - counters only, no locks.
+   counters are independent - a snapshot may be torn across them by a few objects, which a progress bar does not mind */
 class ConProgress
 {
 public:
-	inline void setRepo(const sp<git_repository> &repo) { m_repo = repo; }
+	inline ConProgress() :
+		m_objects_listed(0),
+		m_objects_missing(0),
+		m_objects_total(0),
+		m_objects_requested(0),
+		m_objects_received(0),
+		m_objects_verified(0),
+		m_objects_written(0),
+		m_bytes_total(0),
+		m_bytes_received(0),
+		m_bytes_resumed(0),
+		m_bytes_written(0),
+		m_retries(0),
+		m_timeouts(0)
+	{}
+
+	inline void setObjectsList(const std::vector<oid_t> &objs, const std::vector<oid_t> &missing)
+	{
+		m_objects_listed.store(objs.size(), std::memory_order_relaxed);
+		m_objects_missing.store(missing.size(), std::memory_order_relaxed);
+	}
 
-	inline void setObjectsList(const std::vector<shahex_t> &objs)
+	inline ConEst doEstimate() const
 	{
-		assert(m_repo);
-		std::set<shahex_t> all;
-		for (const auto &obj : objs)
-			all.insert(obj);
-		std::set<shahex_t> mis;
-		for (const auto &obj : objs)
-			if (!git_odb_exists(odb_from_repo(m_repo.get()).get(), git_hex2bin(obj)))
-				mis.insert(obj);
-		m_objects_all = std::move(all);
-		m_objects_missing = std::move(mis);
+		ConEst est;
+		est.m_objects_listed = m_objects_listed.load(std::memory_order_relaxed);
+		est.m_objects_missing = m_objects_missing.load(std::memory_order_relaxed);
+		est.m_objects_total = m_objects_total.load(std::memory_order_relaxed);
+		est.m_objects_requested = m_objects_requested.load(std::memory_order_relaxed);
+		est.m_objects_received = m_objects_received.load(std::memory_order_relaxed);
+		est.m_objects_verified = m_objects_verified.load(std::memory_order_relaxed);
+		est.m_objects_written = m_objects_written.load(std::memory_order_relaxed);
+		est.m_bytes_total = m_bytes_total.load(std::memory_order_relaxed);
+		est.m_bytes_received = m_bytes_received.load(std::memory_order_relaxed);
+		est.m_bytes_resumed = m_bytes_resumed.load(std::memory_order_relaxed);
+		est.m_bytes_written = m_bytes_written.load(std::memory_order_relaxed);
+		est.m_retries = m_retries.load(std::memory_order_relaxed);
+		est.m_timeouts = m_timeouts.load(std::memory_order_relaxed);
+		return est;
 	}
 
-	inline ConEst doEstimate()
+	/* bytes - expected size, zero if unknown (see updater_sizes_get) */
+	inline void onQueued(size_t n, uint64_t bytes)
 	{
-		return ConEst(m_objects_missing.size(), m_objects_all.size(), con_tag_ratio_t());
+		m_bytes_total.fetch_add(bytes, std::memory_order_relaxed);
+		m_objects_total.fetch_add(n, std::memory_order_relaxed);
 	}
 
 	inline void onRequest(const std::string &path, const std::string &data)
 	{
-		std::lock_guard<std::mutex> l(m_mtx);
-		boost::cmatch what;
-		if (boost::regex_search(path.c_str(), what, boost::regex("/objects/([[:xdigit:]]{2})/([[:xdigit:]]{38})"), boost::match_default))
-			m_objects_requested.push_back(boost::algorithm::to_lower_copy(what[1].str() + what[2].str()));
+		oid_t obj;
+		if (con_objpath_parse(path, &obj))
+			m_objects_requested.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	inline void onReceived(size_t len) { m_bytes_received.fetch_add(len, std::memory_order_relaxed); }
+	/* bytes of partial objects continued instead of fetched again (see ConSink::offset) */
+	inline void onResumed(uint64_t len) { m_bytes_resumed.fetch_add(len, std::memory_order_relaxed); }
+	inline void onObjectReceived() { m_objects_received.fetch_add(1, std::memory_order_relaxed); }
+	inline void onObjectVerified() { m_objects_verified.fetch_add(1, std::memory_order_relaxed); }
+
+	inline void onObjectWritten(size_t len)
+	{
+		m_bytes_written.fetch_add(len, std::memory_order_relaxed);
+		m_objects_written.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	inline void onRetry() { m_retries.fetch_add(1, std::memory_order_relaxed); }
+	inline void onTimeout() { m_timeouts.fetch_add(1, std::memory_order_relaxed); }
+
+	/* a pack arrives as one response - the indexer knows the object counts */
+	inline void onPack(size_t total, size_t received, size_t indexed)
+	{
+		m_objects_total.store(total, std::memory_order_relaxed);
+		m_objects_requested.store(total, std::memory_order_relaxed);
+		m_objects_received.store(received, std::memory_order_relaxed);
+		m_objects_verified.store(indexed, std::memory_order_relaxed);
+	}
+
+	inline void onPackWritten(size_t indexed, size_t len)
+	{
+		m_objects_written.store(indexed, std::memory_order_relaxed);
+		m_bytes_written.fetch_add(len, std::memory_order_relaxed);
+	}
+
+	std::atomic<uint64_t> m_objects_listed;
+	std::atomic<uint64_t> m_objects_missing;
+	std::atomic<uint64_t> m_objects_total;
+	std::atomic<uint64_t> m_objects_requested;
+	std::atomic<uint64_t> m_objects_received;
+	std::atomic<uint64_t> m_objects_verified;
+	std::atomic<uint64_t> m_objects_written;
+	std::atomic<uint64_t> m_bytes_total;
+	std::atomic<uint64_t> m_bytes_received;
+	std::atomic<uint64_t> m_bytes_resumed;
+	std::atomic<uint64_t> m_bytes_written;
+	std::atomic<uint64_t> m_retries;
+	std::atomic<uint64_t> m_timeouts;
+};
+
+/* rolling throughput and ETA over ConProgress snapshots - owned by the reader, feed it one sample per frame */
+class ConRate
+{
+public:
+	typedef std::chrono::steady_clock::time_point timept_t;
+
+	inline ConRate(std::chrono::milliseconds window = std::chrono::milliseconds(2000)) :
+		m_window(window),
+		m_samples()
+	{}
+
+	inline void sample(timept_t now, const ConEst &est)
+	{
+		m_samples.push_back(std::make_pair(now, est));
+		/* keep one sample older than the window so the rate spans all of it */
+		while (m_samples.size() > 2 && now - m_samples[1].first >= m_window)
+			m_samples.pop_front();
+	}
+
+	inline double bytesPerSec() const { return _rate(&ConEst::m_bytes_received); }
+	inline double objectsPerSec() const { return _rate(&ConEst::m_objects_written); }
+
+	/* seconds, negative if unknown (nothing queued yet, or stalled) - by bytes if sizes are known */
+	inline double eta() const
+	{
+		if (m_samples.empty())
+			return -1.0;
+		const ConEst &est = m_samples.back().second;
+		if (est.m_bytes_total)
+			return _eta(est.m_bytes_total, est.m_bytes_written, _rate(&ConEst::m_bytes_written));
+		return _eta(est.m_objects_total, est.m_objects_written, objectsPerSec());
 	}
 
+	inline double _eta(uint64_t total, uint64_t done, double rate) const
+	{
+		if (!total || rate <= 0.0)
+			return total && done >= total ? 0.0 : -1.0;
+		return (double) (total - std::min(done, total)) / rate;
+	}
+
+	inline double _rate(uint64_t ConEst::*counter) const
+	{
+		if (m_samples.size() < 2)
+			return 0.0;
+		const double sec = std::chrono::duration<double>(m_samples.back().first - m_samples.front().first).count();
+		if (sec <= 0.0)
+			return 0.0;
+		return (double) (m_samples.back().second.*counter - m_samples.front().second.*counter) / sec;
+	}
+
+	std::chrono::milliseconds m_window;
+	std::deque<std::pair<timept_t, ConEst> > m_samples;
+};
 
-	std::mutex m_mtx;
-	sp<git_repository> m_repo;
-	std::set<shahex_t> m_objects_all;
-	std::set<shahex_t> m_objects_missing;
-	std::vector<shahex_t> m_objects_requested;
+/* receives a response body piecewise as it comes off the connection
+     offset - bytes of the body already held from an earlier attempt, requested from there on (Range) if nonzero
+     restart - the server sent the whole body regardless, drop what is held
+     done - the body is complete */
+class ConSink
+{
+public:
+	inline virtual ~ConSink() {};
+	inline virtual void write(const char *data, size_t len) = 0;
+	inline virtual uint64_t offset() { return 0; }
+	inline virtual void restart() { throw ConExc(); }
+	inline virtual void done() {}
 };
 
 class Con
 {
 public:
+	typedef std::function<void(std::exception_ptr)> handler_t;
+
+	inline Con() :
+		m_prog(new ConProgress())
+	{}
+
 	inline virtual ~Con() {};
 	inline virtual res_t reqPost(const std::string &path, const std::string &data) = 0;
-	
-	ConProgress m_prog;
+	/* response body goes to sink - implementations may stream it */
+	inline virtual void reqPostSink(const std::string &path, const std::string &data, ConSink *sink)
+	{
+		const res_t res = reqPost(path, data);
+		if (sink->offset())
+			sink->restart();
+		m_prog->onReceived(res.body().size());
+		sink->write(res.body().data(), res.body().size());
+		sink->done();
+	}
+	/* response bodies of paths[i] go to sinks[i] without blocking - implementations may overlap the requests and stream the bodies
+	   handler gets the failure (null if none) on a thread running the io_context
+	   only on connections from forkAsync, one call in flight per connection, handler must not throw */
+	inline virtual void reqPostMultiAsync(const std::vector<std::string> &paths, const std::vector<ConSink *> &sinks, const handler_t &handler) = 0;
+	/* another connection to the same origin - progress is shared with the original */
+	inline virtual sp<Con> fork() = 0;
+	/* as fork, but driven by handlers on ioc - for async requests only, any number of connections may share one ioc */
+	inline virtual sp<Con> forkAsync(const sp<boost::asio::io_context> &ioc) = 0;
+
+	sp<ConProgress> m_prog;
 };
 
 class ConNet : public Con
 {
 public:
-	inline ConNet(const std::string &host, const std::string &port, const std::string &host_http_rootpath) :
+	/* get_objects - objects by GET, cacheable by proxies in front of the server (older servers only take POST) */
+	inline ConNet(const std::string &host, const std::string &port, const std::string &host_http_rootpath, size_t pipeline_window = 1, const ConTimeouts &timeouts = ConTimeouts(), const ConRetry &retry = ConRetry(), bool get_objects = false) :
+		ConNet(sp<boost::asio::io_context>(new boost::asio::io_context()), host, port, host_http_rootpath, pipeline_window, timeouts, retry, get_objects)
+	{
+		_reconnect();
+	};
+
+	/* on a shared io_context (see forkAsync) - connects on the first async request */
+	inline ConNet(const sp<boost::asio::io_context> &ioc, const std::string &host, const std::string &port, const std::string &host_http_rootpath, size_t pipeline_window, const ConTimeouts &timeouts, const ConRetry &retry, bool get_objects) :
 		Con(),
 		m_host(host),
 		m_port(port),
 		m_host_http(host + ":" + port),
 		m_host_http_rootpath(host_http_rootpath),
-		m_ioc(),
-		m_resolver(m_ioc),
-		m_resolver_r(m_resolver.resolve(host, port)),
-		m_socket(new tcp::socket(m_ioc))
-	{
-		boost::asio::connect(*m_socket, m_resolver_r.begin(), m_resolver_r.end());
-	};
+		m_pipeline_window(std::max<size_t>(pipeline_window, 1)),
+		m_timeouts(timeouts),
+		m_retry(retry),
+		m_get_objects(get_objects),
+		m_deadline(),
+		m_ioc(ioc),
+		m_strand(m_ioc->get_executor()),
+		m_timer(*m_ioc),
+		m_resolver(*m_ioc),
+		m_resolver_r(),
+		m_socket(new tcp::socket(*m_ioc)),
+		m_a_handler(),
+		m_a_paths(),
+		m_a_sinks(),
+		m_a_sent(0),
+		m_a_done(0),
+		m_a_buffer(),
+		m_a_req(),
+		m_a_parser(),
+		m_a_chunk(),
+		m_a_gen(new uint64_t(0)),
+		m_a_timedout(false)
+	{}
 
 	inline ~ConNet()
 	{
-		m_socket->shutdown(tcp::socket::shutdown_both);
+		/* the peer may have dropped the connection already (see UpdaterFetchPool retries) - nothing to report */
+		boost::system::error_code ec;
+		m_socket->shutdown(tcp::socket::shutdown_both, ec);
+	}
+
+	/* every socket operation is started async and run here to completion, timeout (see ConTimeouts) or the request deadline
+	     a timed out operation is cancelled by closing the socket - the connection is unusable after, reconnect */
+	inline void _run(std::chrono::milliseconds timeout)
+	{
+		std::chrono::steady_clock::duration limit;
+		const bool limited = _limit(timeout, &limit);
+		m_ioc->restart();
+		if (limited)
+			m_ioc->run_for(limit);
+		else
+			m_ioc->run();
+		if (!m_ioc->stopped()) {
+			boost::system::error_code ec;
+			m_resolver.cancel();
+			m_socket->close(ec);
+			m_ioc->run();
+			m_prog->onTimeout();
+			throw boost::system::system_error(boost::asio::error::timed_out);
+		}
+	}
+
+	/* time an operation under timeout may take - the request deadline bounds it too, false if neither does */
+	inline bool _limit(std::chrono::milliseconds timeout, std::chrono::steady_clock::duration *limit)
+	{
+		*limit = timeout;
+		bool limited = !!timeout.count();
+		if (m_deadline != std::chrono::steady_clock::time_point()) {
+			const std::chrono::steady_clock::duration left = (std::max)(m_deadline - std::chrono::steady_clock::now(), std::chrono::steady_clock::duration::zero());
+			*limit = limited ? (std::min)(*limit, left) : left;
+			limited = true;
+		}
+		return limited;
 	}
 
+	/* under the connect timeout only - not the deadline of whatever request is in progress */
 	inline void _reconnect()
 	{
-		m_socket.reset(new tcp::socket(m_ioc));
-		boost::asio::connect(*m_socket, m_resolver_r.begin(), m_resolver_r.end());
+		const std::chrono::steady_clock::time_point deadline = m_deadline;
+		m_deadline = std::chrono::steady_clock::time_point();
+		boost::system::error_code ec = boost::asio::error::would_block;
+		if (m_resolver_r.empty()) {
+			m_resolver.async_resolve(m_host, m_port, [&](const boost::system::error_code &e, const tcp::resolver::results_type &r) { ec = e; m_resolver_r = r; });
+			_run(m_timeouts.m_connect);
+			if (ec)
+				throw boost::system::system_error(ec);
+		}
+		ec = boost::asio::error::would_block;
+		m_socket.reset(new tcp::socket(*m_ioc));
+		boost::asio::async_connect(*m_socket, m_resolver_r, [&](const boost::system::error_code &e, const tcp::endpoint &) { ec = e; });
+		_run(m_timeouts.m_connect);
+		if (ec)
+			throw boost::system::system_error(ec);
+		m_deadline = deadline;
 	}
 
-	inline res_t reqPost_(const std::string &path, const std::string &data)
+	inline void _deadline()
 	{
-		http::request<http::string_body> req(http::verb::post, m_host_http_rootpath + path, 11);
+		m_deadline = m_timeouts.m_request.count() ? std::chrono::steady_clock::now() + m_timeouts.m_request : std::chrono::steady_clock::time_point();
+	}
+
+	inline void _write(http::request<http::string_body> req)
+	{
+		boost::system::error_code ec = boost::asio::error::would_block;
+		http::async_write(*m_socket, req, [&](const boost::system::error_code &e, size_t) { ec = e; });
+		_run(m_timeouts.m_io);
+		if (ec)
+			throw boost::system::system_error(ec);
+	}
+
+	template<typename Parser>
+	inline void _read_header(boost::beast::flat_buffer &buffer, Parser &parser)
+	{
+		boost::system::error_code ec = boost::asio::error::would_block;
+		http::async_read_header(*m_socket, buffer, parser, [&](const boost::system::error_code &e, size_t) { ec = e; });
+		_run(m_timeouts.m_io);
+		if (ec)
+			throw boost::system::system_error(ec);
+	}
+
+	/* need_buffer is no error - the body buffer filled up */
+	template<typename Parser>
+	inline void _read_some(boost::beast::flat_buffer &buffer, Parser &parser)
+	{
+		boost::system::error_code ec = boost::asio::error::would_block;
+		http::async_read(*m_socket, buffer, parser, [&](const boost::system::error_code &e, size_t) { ec = e; });
+		_run(m_timeouts.m_io);
+		if (ec && ec != http::error::need_buffer)
+			throw boost::system::system_error(ec);
+	}
+
+	inline http::request<http::string_body> _req(const std::string &path, const std::string &data = "", uint64_t offset = 0)
+	{
+		oid_t obj;
+		const bool get = m_get_objects && data.empty() && con_objpath_parse(path, &obj);
+		http::request<http::string_body> req(get ? http::verb::get : http::verb::post, m_host_http_rootpath + path, 11);
 		req.set(http::field::host, m_host_http);
 		req.set(http::field::user_agent, BOOST_BEAST_VERSION_STRING);
-		http::write(*m_socket, req);
+		if (offset)
+			req.set(http::field::range, "bytes=" + std::to_string(offset) + "-");
+		req.body() = data;
+		req.prepare_payload();
+		return req;
+	}
+
+	inline res_t reqPost_(const std::string &path, const std::string &data)
+	{
+		_deadline();
+		_write(_req(path, data));
 		boost::beast::flat_buffer buffer;
-		http::response<http::string_body> res;
-		http::read(*m_socket, buffer, res);
+		http::response_parser<http::string_body> parser;
+		parser.body_limit((std::numeric_limits<std::uint64_t>::max)());
+		_read_some(buffer, parser);
+		res_t res = parser.release();
 		// https://github.com/boostorg/beast/issues/927
 		//   Repeated calls to an URL (repeated http::write calls without remaking the socket)
 		//     - needs http::response::keep_alive() true
@@ -145,33 +559,319 @@ public:
 		return res;
 	}
 
+	/* connection level failures (timeouts included) and server side errors are retried over a new connection (see ConRetry)
+	   the request body is a plain string - safe to send again */
 	inline virtual res_t reqPost(const std::string &path, const std::string &data) override
 	{
-		m_prog.onRequest(path, data);
-		res_t res = reqPost_(path, data);
-		if (res.result_int() != 200)
-			throw ConExc();
-		return res;
+		m_prog->onRequest(path, data);
+		for (size_t attempt = 1;; attempt++) {
+			try {
+				if (attempt > 1)
+					_reconnect();
+				res_t res = reqPost_(path, data);
+				if (res.result_int() != 200)
+					throw ConExcStatus(res.result_int());
+				return res;
+			}
+			catch (boost::system::system_error &) {
+				if (attempt >= m_retry.m_attempts)
+					throw;
+			}
+			catch (ConExcStatus &e) {
+				if (e.m_status < 500 || attempt >= m_retry.m_attempts)
+					throw;
+			}
+			m_prog->onRetry();
+			m_retry.backoff(attempt);
+		}
+	}
+
+	/* body streamed into sink through a fixed buffer - never held whole in memory
+	     a sink holding part of the body asked for the rest (see _req) - 206 continues it, 200 restarts it
+	   returns keep-alive of the response */
+	inline bool _read_sink(boost::beast::flat_buffer &buffer, ConSink *sink)
+	{
+		const size_t CHUNK = 65536;
+		std::vector<char> chunk(CHUNK);
+		http::response_parser<http::buffer_body> parser;
+		parser.body_limit((std::numeric_limits<std::uint64_t>::max)());
+		_read_header(buffer, parser);
+		_sink_head(parser, sink);
+		while (!parser.is_done()) {
+			parser.get().body().data = chunk.data();
+			parser.get().body().size = chunk.size();
+			_read_some(buffer, parser);
+			m_prog->onReceived(chunk.size() - parser.get().body().size);
+			sink->write(chunk.data(), chunk.size() - parser.get().body().size);
+		}
+		sink->done();
+		return parser.get().keep_alive();
+	}
+
+	/* status of a response about to stream into sink - 206 continues what the sink holds, 200 restarts it */
+	inline void _sink_head(const http::response_parser<http::buffer_body> &parser, ConSink *sink)
+	{
+		const uint64_t offset = sink->offset();
+		if (parser.get().result_int() == 200 && offset)
+			sink->restart();
+		else if (parser.get().result_int() == 206 && offset) {
+			if (parser.get()[http::field::content_range].find("bytes " + std::to_string(offset) + "-") != 0)
+				throw ConExc();
+			m_prog->onResumed(offset);
+		}
+		else if (parser.get().result_int() != 200)
+			throw ConExcStatus(parser.get().result_int());
+	}
+
+	/* not retried - the sink may not take the body twice (see UpdaterFetchPool for the retrying one) */
+	inline virtual void reqPostSink(const std::string &path, const std::string &data, ConSink *sink) override
+	{
+		m_prog->onRequest(path, data);
+		_deadline();
+		_write(_req(path, data, sink->offset()));
+		boost::beast::flat_buffer buffer;
+		if (!_read_sink(buffer, sink))
+			_reconnect();
+	}
+
+	/* HTTP/1.1 pipelining - keeps up to m_pipeline_window requests in flight, responses arrive in request order
+	     a chain of handlers on the shared io_context, m_a_buffer lives across reads as one read may pull in bytes of the following response
+	     each response gets its own request deadline
+	   a response without keep-alive means the server closes after it - whatever else was in flight is lost
+	     reconnect, resend the unanswered requests and stay at one request in flight for the rest of the connection (see _a_single)
+	     handlers of the connection run serialized on m_strand, the call in flight keeps its state in the m_a_ members
+	     every operation arms m_timer as _run would wait (see ConTimeouts) - on expiry the socket is closed, failing the operation
+	     not retried - the handler gets the failure, the connection is closed and reconnects on the next call */
+	inline virtual void reqPostMultiAsync(const std::vector<std::string> &paths, const std::vector<ConSink *> &sinks, const handler_t &handler) override
+	{
+		assert(paths.size() == sinks.size() && !m_a_handler);
+		for (const auto &path : paths)
+			m_prog->onRequest(path, "");
+		m_a_handler = handler;
+		m_a_paths = paths;
+		m_a_sinks = sinks;
+		m_a_sent = 0;
+		m_a_done = 0;
+		m_a_buffer.clear();
+		boost::asio::post(m_strand, [this]() { _a_try([&]() { _a_step(); }); });
+	}
+
+	template<typename F>
+	inline void _a_try(F f)
+	{
+		try {
+			f();
+		}
+		catch (std::exception &) {
+			_a_finish(std::current_exception());
+		}
+	}
+
+	/* last thing a handler chain does - the handler may destroy or reuse the connection */
+	inline void _a_finish(std::exception_ptr e)
+	{
+		handler_t handler;
+		std::swap(handler, m_a_handler);
+		m_a_paths.clear();
+		m_a_sinks.clear();
+		m_a_req.reset();
+		m_a_parser.reset();
+		if (e) {
+			boost::system::error_code ec;
+			m_socket->close(ec);
+		}
+		handler(e);
+	}
+
+	inline void _a_arm(std::chrono::milliseconds timeout)
+	{
+		const uint64_t gen = ++*m_a_gen;
+		const sp<uint64_t> gens = m_a_gen;
+		std::chrono::steady_clock::duration limit;
+		m_a_timedout = false;
+		if (!_limit(timeout, &limit))
+			return;
+		m_timer.expires_after(limit);
+		m_timer.async_wait(boost::asio::bind_executor(m_strand, [this, gen, gens](const boost::system::error_code &ec) {
+			/* expired as the operation completed (or the connection is gone) - the generation moved on */
+			if (ec || *gens != gen)
+				return;
+			boost::system::error_code ec_;
+			m_a_timedout = true;
+			m_prog->onTimeout();
+			m_resolver.cancel();
+			m_socket->close(ec_);
+		}));
+	}
+
+	/* throws the failure of the completed operation - one cut short by _a_arm as timed_out */
+	inline void _a_disarm(const boost::system::error_code &ec)
+	{
+		++*m_a_gen;
+		m_timer.cancel();
+		if (ec)
+			throw boost::system::system_error(m_a_timedout ? boost::system::error_code(boost::asio::error::timed_out) : ec);
+	}
+
+	/* under the connect timeout only - like _reconnect */
+	inline void _a_connect()
+	{
+		m_deadline = std::chrono::steady_clock::time_point();
+		if (m_resolver_r.empty()) {
+			_a_arm(m_timeouts.m_connect);
+			m_resolver.async_resolve(m_host, m_port, boost::asio::bind_executor(m_strand, [this](const boost::system::error_code &ec, const tcp::resolver::results_type &r) {
+				_a_try([&]() {
+					_a_disarm(ec);
+					m_resolver_r = r;
+					_a_connect();
+				});
+			}));
+			return;
+		}
+		m_socket.reset(new tcp::socket(*m_ioc));
+		_a_arm(m_timeouts.m_connect);
+		boost::asio::async_connect(*m_socket, m_resolver_r, boost::asio::bind_executor(m_strand, [this](const boost::system::error_code &ec, const tcp::endpoint &) {
+			_a_try([&]() {
+				_a_disarm(ec);
+				_a_step();
+			});
+		}));
+	}
+
+	inline void _a_step()
+	{
+		if (m_a_done == m_a_paths.size())
+			return _a_finish(std::exception_ptr());
+		if (!m_socket->is_open())
+			return _a_connect();
+		_deadline();
+		_a_write();
+	}
+
+	/* the server closes after a response (or refused the pipelined requests) - resend the unanswered ones, one in flight */
+	inline void _a_single()
+	{
+		boost::system::error_code ec;
+		m_pipeline_window = 1;
+		m_socket->close(ec);
+		m_a_buffer.clear();
+		m_a_sent = m_a_done;
+		_a_step();
+	}
+
+	/* tops the pipeline up to m_pipeline_window, then reads the oldest response */
+	inline void _a_write()
+	{
+		if (m_a_sent == m_a_paths.size() || m_a_sent - m_a_done >= m_pipeline_window)
+			return _a_read_header();
+		m_a_req.reset(new http::request<http::string_body>(_req(m_a_paths[m_a_sent], "", m_a_sinks[m_a_sent]->offset())));
+		_a_arm(m_timeouts.m_io);
+		http::async_write(*m_socket, *m_a_req, boost::asio::bind_executor(m_strand, [this](const boost::system::error_code &ec, size_t) {
+			_a_try([&]() {
+				try {
+					_a_disarm(ec);
+				}
+				catch (boost::system::system_error &) {
+					if (m_pipeline_window == 1)
+						throw;
+					return _a_single();
+				}
+				m_a_sent++;
+				_a_write();
+			});
+		}));
+	}
+
+	inline void _a_read_header()
+	{
+		m_a_parser.reset(new http::response_parser<http::buffer_body>());
+		m_a_parser->body_limit((std::numeric_limits<std::uint64_t>::max)());
+		_a_arm(m_timeouts.m_io);
+		http::async_read_header(*m_socket, m_a_buffer, *m_a_parser, boost::asio::bind_executor(m_strand, [this](const boost::system::error_code &ec, size_t) {
+			_a_try([&]() {
+				_a_disarm(ec);
+				_sink_head(*m_a_parser, m_a_sinks[m_a_done]);
+				_a_read_body();
+			});
+		}));
+	}
+
+	inline void _a_read_body()
+	{
+		if (m_a_parser->is_done()) {
+			m_a_sinks[m_a_done++]->done();
+			if (!m_a_parser->get().keep_alive())
+				return _a_single();
+			return _a_step();
+		}
+		m_a_chunk.resize(65536);
+		m_a_parser->get().body().data = m_a_chunk.data();
+		m_a_parser->get().body().size = m_a_chunk.size();
+		_a_arm(m_timeouts.m_io);
+		http::async_read(*m_socket, m_a_buffer, *m_a_parser, boost::asio::bind_executor(m_strand, [this](const boost::system::error_code &ec, size_t) {
+			_a_try([&]() {
+				/* need_buffer is no error - the chunk filled up */
+				_a_disarm(ec == http::error::need_buffer ? boost::system::error_code() : ec);
+				const size_t len = m_a_chunk.size() - m_a_parser->get().body().size;
+				m_prog->onReceived(len);
+				m_a_sinks[m_a_done]->write(m_a_chunk.data(), len);
+				_a_read_body();
+			});
+		}));
+	}
+
+	inline virtual sp<Con> fork() override
+	{
+		sp<Con> con(new ConNet(m_host, m_port, m_host_http_rootpath, m_pipeline_window, m_timeouts, m_retry, m_get_objects));
+		con->m_prog = m_prog;
+		return con;
+	}
+
+	inline virtual sp<Con> forkAsync(const sp<boost::asio::io_context> &ioc) override
+	{
+		sp<Con> con(new ConNet(ioc, m_host, m_port, m_host_http_rootpath, m_pipeline_window, m_timeouts, m_retry, m_get_objects));
+		con->m_prog = m_prog;
+		return con;
 	}
 
 	std::string m_host;
 	std::string m_port;
 	std::string m_host_http;
 	std::string m_host_http_rootpath;
-	boost::asio::io_context m_ioc;
+	size_t m_pipeline_window;
+	ConTimeouts m_timeouts;
+	ConRetry m_retry;
+	bool m_get_objects;
+	std::chrono::steady_clock::time_point m_deadline;
+	sp<boost::asio::io_context> m_ioc;
+	boost::asio::strand<boost::asio::io_context::executor_type> m_strand;
+	boost::asio::steady_timer m_timer;
 	tcp::resolver m_resolver;
 	tcp::resolver::results_type m_resolver_r;
 	sp<tcp::socket> m_socket;
+	handler_t m_a_handler;
+	std::vector<std::string> m_a_paths;
+	std::vector<ConSink *> m_a_sinks;
+	size_t m_a_sent;
+	size_t m_a_done;
+	boost::beast::flat_buffer m_a_buffer;
+	up<http::request<http::string_body> > m_a_req;
+	up<http::response_parser<http::buffer_body> > m_a_parser;
+	std::vector<char> m_a_chunk;
+	/* shared with the timer handlers - they may outlive the connection */
+	sp<uint64_t> m_a_gen;
+	bool m_a_timedout;
 };
 
 class ConFs : public Con
 {
 public:
-	inline ConFs(const std::string &gitdir) :
+	inline ConFs(const std::string &gitdir, const sp<boost::asio::io_context> &ioc = sp<boost::asio::io_context>()) :
 		Con(),
 		m_gitdir(gitdir),
 		m_objdir(m_gitdir / "objects"),
-		m_refdir(m_gitdir / "refs")
+		m_refdir(m_gitdir / "refs"),
+		m_ioc(ioc)
 	{
 		if (!boost::filesystem::exists(m_gitdir) ||
 			!boost::filesystem::exists(m_objdir) ||
@@ -187,15 +887,320 @@ public:
 
 	inline virtual res_t reqPost(const std::string &path, const std::string &data) override
 	{
-		m_prog.onRequest(path, data);
+		m_prog->onRequest(path, data);
+		/* server-computed routes (/delta/, /sizes/, ..) have no file - answer like a server lacking them */
+		if (!boost::filesystem::is_regular_file(m_gitdir / path))
+			throw ConExc();
 		return res_t(boost::beast::http::status::ok, 11, ps::cruft_file_read(m_gitdir / path));
 	}
 
+	inline virtual void reqPostSink(const std::string &path, const std::string &data, ConSink *sink) override
+	{
+		m_prog->onRequest(path, data);
+		std::vector<char> chunk(65536);
+		std::ifstream ff((m_gitdir / path).string().c_str(), std::ios::in | std::ios::binary);
+		if (!ff.good())
+			throw std::runtime_error("file read");
+		/* continue a held part like a server honouring Range would */
+		const uint64_t offset = sink->offset();
+		if (offset && offset < boost::filesystem::file_size(m_gitdir / path)) {
+			ff.seekg(offset);
+			m_prog->onResumed(offset);
+		}
+		else if (offset)
+			sink->restart();
+		while (ff.read(chunk.data(), chunk.size()) || ff.gcount()) {
+			m_prog->onReceived((size_t) ff.gcount());
+			sink->write(chunk.data(), (size_t) ff.gcount());
+		}
+		if (!ff.eof())
+			throw std::runtime_error("file read");
+		sink->done();
+	}
+
+	/* one file per handler - connections sharing the io_context take turns */
+	inline virtual void reqPostMultiAsync(const std::vector<std::string> &paths, const std::vector<ConSink *> &sinks, const handler_t &handler) override
+	{
+		assert(paths.size() == sinks.size() && m_ioc);
+		_a_next(paths, sinks, 0, handler);
+	}
+
+	inline void _a_next(const std::vector<std::string> &paths, const std::vector<ConSink *> &sinks, size_t i, const handler_t &handler)
+	{
+		boost::asio::post(*m_ioc, [this, paths, sinks, i, handler]() {
+			std::exception_ptr e;
+			try {
+				if (i < paths.size())
+					reqPostSink(paths[i], "", sinks[i]);
+			}
+			catch (std::exception &) {
+				e = std::current_exception();
+			}
+			if (e || i + 1 >= paths.size())
+				handler(e);
+			else
+				_a_next(paths, sinks, i + 1, handler);
+		});
+	}
+
+	inline virtual sp<Con> fork() override
+	{
+		sp<Con> con(new ConFs(m_gitdir.string()));
+		con->m_prog = m_prog;
+		return con;
+	}
+
+	inline virtual sp<Con> forkAsync(const sp<boost::asio::io_context> &ioc) override
+	{
+		sp<Con> con(new ConFs(m_gitdir.string(), ioc));
+		con->m_prog = m_prog;
+		return con;
+	}
+
 	boost::filesystem::path m_gitdir;
 	boost::filesystem::path m_objdir;
 	boost::filesystem::path m_refdir;
+	sp<boost::asio::io_context> m_ioc;
 };
 
+/* one origin spread over several mirrors serving the same repository - objects are content-addressed and verified
+     at construction every mirror is probed (a request for probe, in parallel) and ranked by latency, failed ones are left out
+     forks (the fetch pool connections - see UpdaterFetchPool) take turns over the spread fastest mirrors
+     object requests go to the mirror of the connection, others (refs, delta lists, sizes, manifests) to the origin (mirrors[origin])
+       the origin is authoritative for refs - a lagging mirror would give an older head, no mirror answers in its place
+       an origin not answering the probe fails construction
+     a mirror failing at connection level (or server side) is marked down, an object request fails over to the next one
+       client errors (4xx) are not failed over - the request fails as it would on a plain ConNet
+       the mirrors should not retry themselves - a full round of mirrors failing backs off per retry (see ConRetry)
+       once every mirror is down they all get another chance
+     reqPostSink and reqPostMultiAsync do not fail over - the sinks may not take the bodies twice
+       the mirror is marked down, the failure goes to the caller (UpdaterFetchPool retries over a new fork, on another mirror) */
+class ConMirror : public Con
+{
+public:
+	/* shared by a ConMirror and its forks */
+	class Set
+	{
+	public:
+		inline Set(const std::vector<sp<Con> > &mirrors, size_t origin, size_t spread) :
+			m_mtx(),
+			m_mirrors(mirrors),
+			m_origin(origin),
+			m_latency(mirrors.size(), std::chrono::steady_clock::duration::max()),
+			m_rank(),
+			m_down(mirrors.size(), false),
+			m_spread(std::max<size_t>(spread, 1)),
+			m_next(0)
+		{}
+
+		/* fastest first, down ones last */
+		inline std::vector<size_t> order(size_t first)
+		{
+			std::lock_guard<std::mutex> l(m_mtx);
+			std::vector<size_t> order = { first };
+			for (const size_t i : m_rank)
+				if (i != first && !m_down[i])
+					order.push_back(i);
+			for (const size_t i : m_rank)
+				if (i != first && m_down[i])
+					order.push_back(i);
+			return order;
+		}
+
+		/* round robin over the spread fastest mirrors not down */
+		inline size_t next()
+		{
+			std::lock_guard<std::mutex> l(m_mtx);
+			std::vector<size_t> up;
+			for (const size_t i : m_rank)
+				if (!m_down[i] && up.size() < m_spread)
+					up.push_back(i);
+			return up[m_next++ % up.size()];
+		}
+
+		inline void down(size_t i)
+		{
+			std::lock_guard<std::mutex> l(m_mtx);
+			m_down[i] = true;
+			if (std::all_of(m_rank.begin(), m_rank.end(), [&](size_t j) { return m_down[j]; }))
+				std::fill(m_down.begin(), m_down.end(), false);
+		}
+
+		std::mutex m_mtx;
+		std::vector<sp<Con> > m_mirrors;
+		size_t m_origin;
+		std::vector<std::chrono::steady_clock::duration> m_latency;
+		std::vector<size_t> m_rank;
+		std::vector<bool> m_down;
+		size_t m_spread;
+		size_t m_next;
+	};
+
+	inline ConMirror(const std::vector<sp<Con> > &mirrors, size_t origin, size_t spread, const ConRetry &retry = ConRetry(), const std::string &probe = "/refs/heads/master") :
+		Con(),
+		m_set(new Set(mirrors, origin, spread)),
+		m_retry(retry),
+		m_ioc(),
+		m_cur(0),
+		m_cons(mirrors)
+	{
+		for (const auto &mirror : m_set->m_mirrors)
+			mirror->m_prog = m_prog;
+		std::vector<std::thread> thrs;
+		for (size_t i = 0; i < m_set->m_mirrors.size(); i++)
+			thrs.push_back(std::thread([this, i, probe]() {
+				try {
+					const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+					m_set->m_mirrors[i]->reqPost(probe, "");
+					m_set->m_latency[i] = std::chrono::steady_clock::now() - start;
+				}
+				catch (std::exception &) {
+				}
+			}));
+		for (auto &t : thrs)
+			t.join();
+		for (size_t i = 0; i < m_set->m_mirrors.size(); i++)
+			if (m_set->m_latency[i] != std::chrono::steady_clock::duration::max())
+				m_set->m_rank.push_back(i);
+		if (origin >= m_set->m_mirrors.size() || m_set->m_latency[origin] == std::chrono::steady_clock::duration::max())
+			throw ConExc();
+		std::stable_sort(m_set->m_rank.begin(), m_set->m_rank.end(), [&](size_t a, size_t b) { return m_set->m_latency[a] < m_set->m_latency[b]; });
+		m_cur = m_set->m_rank.front();
+	}
+
+	/* a fork - on mirror cur, connections made on demand */
+	inline ConMirror(const sp<Set> &set, size_t cur, const ConRetry &retry, const sp<boost::asio::io_context> &ioc) :
+		Con(),
+		m_set(set),
+		m_retry(retry),
+		m_ioc(ioc),
+		m_cur(cur),
+		m_cons(set->m_mirrors.size())
+	{}
+
+	inline Con * _con(size_t i)
+	{
+		if (!m_cons[i]) {
+			m_cons[i] = m_ioc ? m_set->m_mirrors[i]->forkAsync(m_ioc) : m_set->m_mirrors[i]->fork();
+			m_cons[i]->m_prog = m_prog;
+		}
+		return m_cons[i].get();
+	}
+
+	/* connection level failures and server side errors - the mirror is marked down */
+	inline bool _down(std::exception_ptr e, size_t i)
+	{
+		try {
+			std::rethrow_exception(e);
+		}
+		catch (boost::system::system_error &) {
+		}
+		catch (ConExcStatus &s) {
+			if (s.m_status < 500)
+				return false;
+		}
+		catch (std::exception &) {
+			return false;
+		}
+		m_set->down(i);
+		return true;
+	}
+
+	inline virtual res_t reqPost(const std::string &path, const std::string &data) override
+	{
+		oid_t obj;
+		const std::vector<size_t> order = con_objpath_parse(path, &obj) ? m_set->order(m_cur) : std::vector<size_t>{ m_set->m_origin };
+		for (size_t k = 0;; k++) {
+			const size_t i = order[k % order.size()];
+			try {
+				return _con(i)->reqPost(path, data);
+			}
+			catch (std::exception &) {
+				/* a client error (unknown object or route) fails here as it would anywhere */
+				if (!_down(std::current_exception(), i))
+					throw;
+				m_cons[i].reset();
+				if (k + 1 >= order.size() * m_retry.m_attempts)
+					throw;
+			}
+			m_prog->onRetry();
+			if ((k + 1) % order.size() == 0)
+				m_retry.backoff((k + 1) / order.size());
+		}
+	}
+
+	inline virtual void reqPostSink(const std::string &path, const std::string &data, ConSink *sink) override
+	{
+		try {
+			_con(m_cur)->reqPostSink(path, data, sink);
+		}
+		catch (std::exception &) {
+			if (_down(std::current_exception(), m_cur))
+				m_cons[m_cur].reset();
+			throw;
+		}
+	}
+
+	inline virtual void reqPostMultiAsync(const std::vector<std::string> &paths, const std::vector<ConSink *> &sinks, const handler_t &handler) override
+	{
+		const size_t i = m_cur;
+		_con(i)->reqPostMultiAsync(paths, sinks, [this, i, handler](std::exception_ptr e) {
+			if (e)
+				_down(e, i);
+			handler(e);
+		});
+	}
+
+	inline virtual sp<Con> fork() override
+	{
+		sp<Con> con(new ConMirror(m_set, m_set->next(), m_retry, sp<boost::asio::io_context>()));
+		con->m_prog = m_prog;
+		return con;
+	}
+
+	inline virtual sp<Con> forkAsync(const sp<boost::asio::io_context> &ioc) override
+	{
+		sp<Con> con(new ConMirror(m_set, m_set->next(), m_retry, ioc));
+		con->m_prog = m_prog;
+		return con;
+	}
+
+	sp<Set> m_set;
+	ConRetry m_retry;
+	sp<boost::asio::io_context> m_ioc;
+	size_t m_cur;
+	std::vector<sp<Con> > m_cons;
+};
+
+/* ORIGIN_DOMAIN_API:LISTEN_PORT (the nginx front of ps_serv.conf, caching /objects/), followed by the mirrors of UPDATER_MIRRORS ("host:port" separated by spaces) if any
+   a mirror not accepting connections is left out, the origin not accepting them fails - the origin alone is a plain ConNet */
+inline sp<Con>
+con_net_from_config(const pt_t &config)
+{
+	const size_t window = config.get<size_t>("UPDATER_PIPELINE_WINDOW", 1);
+	const ConTimeouts timeouts = con_timeouts_from_config(config);
+	const ConRetry retry = con_retry_from_config(config);
+	const bool get = config.get<int>("UPDATER_GET_OBJECTS", 0);
+	std::vector<std::string> specs;
+	boost::split(specs, config.get<std::string>("UPDATER_MIRRORS", ""), boost::is_any_of(" "), boost::token_compress_on);
+	specs.erase(std::remove(specs.begin(), specs.end(), ""), specs.end());
+	if (specs.empty())
+		return sp<Con>(new ConNet(config.get<std::string>("ORIGIN_DOMAIN_API"), config.get<std::string>("LISTEN_PORT"), "", window, timeouts, retry, get));
+	const size_t origin = 0;
+	std::vector<sp<Con> > mirrors = { sp<Con>(new ConNet(config.get<std::string>("ORIGIN_DOMAIN_API"), config.get<std::string>("LISTEN_PORT"), "", window, timeouts, ConRetry(), get)) };
+	for (const auto &spec : specs) {
+		const size_t colon = spec.rfind(':');
+		if (colon == std::string::npos)
+			throw std::runtime_error("mirror spec");
+		try {
+			mirrors.push_back(sp<Con>(new ConNet(spec.substr(0, colon), spec.substr(colon + 1), "", window, timeouts, ConRetry(), get)));
+		}
+		catch (boost::system::system_error &) {
+		}
+	}
+	return sp<Con>(new ConMirror(mirrors, origin, config.get<size_t>("UPDATER_MIRROR_SPREAD", 2), retry));
+}
+
 }
 
 #endif /* _Con_HPP_ */
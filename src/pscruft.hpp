@@ -141,9 +141,8 @@ cruft_config_get_path(
 }
 
 inline void
-cruft_file_write_moving(const std::string &finalpathdir_creation_lump_check, const boost::filesystem::path &finalpath, const std::string &content)
+cruft_file_finalpathdir_prepare(const std::string &finalpathdir_creation_lump_check, const boost::filesystem::path &finalpath)
 {
-	/* prepare final */
 	const boost::filesystem::path finalpathdir = finalpath.parent_path();
 	if (finalpathdir_creation_lump_check.size()) {
 		if (finalpathdir.string().find(finalpathdir_creation_lump_check) == std::string::npos)
@@ -155,16 +154,125 @@ cruft_file_write_moving(const std::string &finalpathdir_creation_lump_check, con
 			/* empty */
 		}
 	}
-	/* write temp */
-	boost::filesystem::path temppath = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("pstmp_%%%%-%%%%-%%%%-%%%%");
-	std::ofstream ff(temppath.string(), std::ios::out | std::ios::trunc | std::ios::binary);
+}
+
+/* cruft_file_write_moving for content arriving piecewise
+     written to a temp file, renamed over finalpath by commit
+     a temp file never committed is removed */
+class CruftFileWriteMoving
+{
+public:
+	inline CruftFileWriteMoving() :
+		m_temppath(boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("pstmp_%%%%-%%%%-%%%%-%%%%")),
+		m_ff(m_temppath.string(), std::ios::out | std::ios::trunc | std::ios::binary),
+		m_done(false)
+	{
+		if (!m_ff.good())
+			throw std::runtime_error("file write");
+	}
+
+	inline ~CruftFileWriteMoving()
+	{
+		if (!m_done) {
+			boost::system::error_code ec;
+			m_ff.close();
+			boost::filesystem::remove(m_temppath, ec);
+		}
+	}
+
+	inline void write(const char *data, size_t len)
+	{
+		m_ff.write(data, len);
+	}
+
+	inline void commit(const std::string &finalpathdir_creation_lump_check, const boost::filesystem::path &finalpath)
+	{
+		/* prepare final */
+		cruft_file_finalpathdir_prepare(finalpathdir_creation_lump_check, finalpath);
+		/* write temp */
+		m_ff.flush();
+		m_ff.close();
+		if (!m_ff.good())
+			throw std::runtime_error("file write");
+		/* write final */
+		cruft_rename_file_file(m_temppath.string(), finalpath.string());
+		m_done = true;
+	}
+
+	boost::filesystem::path m_temppath;
+	std::ofstream m_ff;
+	bool m_done;
+};
+
+/* CruftFileWriteMoving kept across failures
+     written to stagepath (opened appending), renamed over finalpath by commit
+     a stagepath never committed is left in place - the next instance continues it, m_size bytes are already there */
+class CruftFileWriteResumable
+{
+public:
+	inline CruftFileWriteResumable(const std::string &finalpathdir_creation_lump_check, const boost::filesystem::path &stagepath) :
+		m_stagepath(stagepath),
+		m_ff(),
+		m_size(0)
+	{
+		cruft_file_finalpathdir_prepare(finalpathdir_creation_lump_check, m_stagepath);
+		if (boost::filesystem::exists(m_stagepath))
+			m_size = boost::filesystem::file_size(m_stagepath);
+	}
+
+	/* separate from the constructor - the existing content may be read back first */
+	inline void open()
+	{
+		m_ff.open(m_stagepath.string(), std::ios::out | std::ios::app | std::ios::binary);
+		if (!m_ff.good())
+			throw std::runtime_error("file write");
+	}
+
+	inline void write(const char *data, size_t len)
+	{
+		m_ff.write(data, len);
+		m_size += len;
+	}
+
+	inline void truncate()
+	{
+		m_ff.close();
+		m_ff.open(m_stagepath.string(), std::ios::out | std::ios::trunc | std::ios::binary);
+		if (!m_ff.good())
+			throw std::runtime_error("file write");
+		m_size = 0;
+	}
+
+	/* content known bad - do not let the next instance continue it */
+	inline void discard()
+	{
+		boost::system::error_code ec;
+		m_ff.close();
+		boost::filesystem::remove(m_stagepath, ec);
+		m_size = 0;
+	}
+
+	inline void commit(const std::string &finalpathdir_creation_lump_check, const boost::filesystem::path &finalpath)
+	{
+		cruft_file_finalpathdir_prepare(finalpathdir_creation_lump_check, finalpath);
+		m_ff.flush();
+		m_ff.close();
+		if (!m_ff.good())
+			throw std::runtime_error("file write");
+		cruft_rename_file_file(m_stagepath.string(), finalpath.string());
+	}
+
+	boost::filesystem::path m_stagepath;
+	std::ofstream m_ff;
+	uint64_t m_size;
+};
+
+inline void
+cruft_file_write_moving(const std::string &finalpathdir_creation_lump_check, const boost::filesystem::path &finalpath, const std::string &content)
+{
+	CruftFileWriteMoving ff;
 	ff.write(content.data(), content.size());
-	ff.flush();
-	ff.close();
-	if (!ff.good())
-		throw std::runtime_error("file write");
-	/* write final */
-	cruft_rename_file_file(temppath.string(), finalpath.string());
+	ff.commit(finalpathdir_creation_lump_check, finalpath);
 }
 
 inline std::string
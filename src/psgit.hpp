@@ -1,14 +1,23 @@
 #ifndef _PSGIT_HPP_
 #define _PSGIT_HPP_
 
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
 #include <map>
 #include <memory>
+#include <set>
 #include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
+#include <boost/filesystem.hpp>
 #include <boost/regex.hpp>
 #include <git2.h>
 #include <miniz.h>
@@ -19,7 +28,10 @@
 typedef ::std::unique_ptr<git_blob, void(*)(git_blob *)> unique_ptr_gitblob;
 typedef ::std::unique_ptr<git_buf, void(*)(git_buf *)> unique_ptr_gitbuf;
 typedef ::std::unique_ptr<git_commit, void(*)(git_commit *)> unique_ptr_gitcommit;
+typedef ::std::unique_ptr<git_diff, void(*)(git_diff *)> unique_ptr_gitdiff;
+typedef ::std::unique_ptr<git_indexer, void(*)(git_indexer *)> unique_ptr_gitindexer;
 typedef ::std::unique_ptr<git_odb, void(*)(git_odb *)> unique_ptr_gitodb;
+typedef ::std::unique_ptr<git_odb_stream, void(*)(git_odb_stream *)> unique_ptr_gitodbstream;
 typedef ::std::unique_ptr<git_repository, void(*)(git_repository *)> unique_ptr_gitrepository;
 typedef ::std::unique_ptr<git_signature, void(*)(git_signature *)> unique_ptr_gitsignature;
 typedef ::std::unique_ptr<git_tree, void(*)(git_tree *)> unique_ptr_gittree;
@@ -36,10 +48,19 @@ public:
 		m_type(),
 		m_data_offset()
 	{
-		/* format: "(type)(space)(number)(NULL)" */
-		boost::cmatch what(cruft_regex_search("([[:alpha:]]+) ([[:digit:]]+)\000", incoming_data));
-		m_type = what[1];
-		m_data_offset = (what[0].second + 1) - what[0].first;
+		/* format: "(type)(space)(number)(NULL)" - parsed by hand, runs for every object */
+		const char *beg = incoming_data.data(), *end = beg + incoming_data.size(), *p = beg;
+		while (p != end && isalpha((unsigned char) *p))
+			p++;
+		if (p == beg || p == end || *p != ' ')
+			throw std::runtime_error("odi type");
+		m_type.assign(beg, p++);
+		const char *num = p;
+		while (p != end && isdigit((unsigned char) *p))
+			p++;
+		if (p == num || p == end || *p != '\0')
+			throw std::runtime_error("odi size");
+		m_data_offset = (p + 1) - beg;
 		if (m_data_offset >= incoming_data.size())
 			throw std::runtime_error("odi data_offset");
 	}
@@ -115,6 +136,27 @@ git_bin2hex(const git_oid &oid)
 	return std::string(git_oid_tostr(buf, sizeof buf, &oid));
 }
 
+inline git_oid
+git_oidt2bin(const oid_t &oid)
+{
+	git_oid out = {};
+	git_oid_fromraw(&out, oid.m_id.data());
+	return out;
+}
+
+inline oid_t
+git_bin2oidt(const git_oid &oid)
+{
+	return oid_t::fromraw(oid.id);
+}
+
+inline void
+git_oideq(const oid_t &a, const oid_t &b)
+{
+	if (a != b)
+		throw std::runtime_error("not oid equals");
+}
+
 inline void
 git_hexeq(const shahex_t &a, const shahex_t &b)
 {
@@ -142,6 +184,181 @@ git_incoming_data_hex(const std::string &incoming_data)
 	return git_bin2hex(oid_loose);
 }
 
+/* incremental SHA-1 (FIPS 180-4) - libgit2 only hashes whole buffers (git_odb_hash) */
+class GitSha1
+{
+public:
+	inline GitSha1() :
+		m_h{ 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 },
+		m_blk(),
+		m_len(0)
+	{}
+
+	inline void update(const char *data, size_t len)
+	{
+		while (len) {
+			const size_t off = m_len % 64;
+			const size_t n = std::min(len, 64 - off);
+			memcpy(m_blk + off, data, n);
+			m_len += n;
+			data += n;
+			len -= n;
+			if (off + n == 64)
+				_block();
+		}
+	}
+
+	inline void finish(unsigned char raw[GIT_OID_RAWSZ])
+	{
+		const uint64_t bits = m_len * 8;
+		const char pad = (char) 0x80;
+		const char zero[64] = {};
+		update(&pad, 1);
+		update(zero, (64 + 56 - m_len % 64) % 64);
+		char be[8];
+		for (size_t i = 0; i < 8; i++)
+			be[i] = (char) (bits >> (56 - 8 * i));
+		update(be, 8);
+		for (size_t i = 0; i < 5; i++)
+			for (size_t j = 0; j < 4; j++)
+				raw[i * 4 + j] = (unsigned char) (m_h[i] >> (24 - 8 * j));
+	}
+
+	static inline uint32_t _rol(uint32_t x, int n) { return (x << n) | (x >> (32 - n)); }
+
+	inline void _block()
+	{
+		uint32_t w[80];
+		for (size_t i = 0; i < 16; i++)
+			w[i] = (uint32_t) m_blk[i * 4] << 24 | (uint32_t) m_blk[i * 4 + 1] << 16 | (uint32_t) m_blk[i * 4 + 2] << 8 | (uint32_t) m_blk[i * 4 + 3];
+		for (size_t i = 16; i < 80; i++)
+			w[i] = _rol(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+		uint32_t a = m_h[0], b = m_h[1], c = m_h[2], d = m_h[3], e = m_h[4];
+		for (size_t i = 0; i < 80; i++) {
+			uint32_t f, k;
+			if (i < 20)      { f = (b & c) | (~b & d);          k = 0x5A827999; }
+			else if (i < 40) { f = b ^ c ^ d;                   k = 0x6ED9EBA1; }
+			else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+			else             { f = b ^ c ^ d;                   k = 0xCA62C1D6; }
+			const uint32_t t = _rol(a, 5) + f + e + k + w[i];
+			e = d; d = c; c = _rol(b, 30); b = a; a = t;
+		}
+		m_h[0] += a; m_h[1] += b; m_h[2] += c; m_h[3] += d; m_h[4] += e;
+	}
+
+	uint32_t m_h[5];
+	unsigned char m_blk[64];
+	uint64_t m_len;
+};
+
+/* loose object verification without materialising the inflated object
+     inflates chunk by chunk, the "(type)(space)(number)(NULL)" header is parsed as it arrives
+     the object id is the SHA-1 of the whole inflated stream (header included) - fed incrementally
+   peak memory is the chunk size whatever the object size */
+class GitLooseVerifier
+{
+public:
+	inline GitLooseVerifier() :
+		m_strm(),
+		m_sha(),
+		m_hdr(),
+		m_hdr_done(false),
+		m_end(false),
+		m_type(),
+		m_size(0),
+		m_have(0),
+		m_content()
+	{
+		if (inflateInit(&m_strm) != Z_OK)
+			throw std::runtime_error("inflate init");
+	}
+
+	inline ~GitLooseVerifier()
+	{
+		inflateEnd(&m_strm);
+	}
+
+	GitLooseVerifier(const GitLooseVerifier &) = delete;
+	GitLooseVerifier & operator=(const GitLooseVerifier &) = delete;
+
+	inline void update(const char *data, size_t len)
+	{
+		const size_t CHUNK = 16384;
+		char out[CHUNK];
+
+		m_strm.avail_in = (unsigned int) len;
+		m_strm.next_in = (Bytef *) data;
+
+		/* a full output chunk may leave more pending inside zlib even with all input consumed */
+		while (!m_end && (m_strm.avail_in || m_strm.avail_out == 0)) {
+			m_strm.avail_out = CHUNK;
+			m_strm.next_out = (Bytef *) out;
+			const int ret = inflate(&m_strm, Z_NO_FLUSH);
+			if (ret == Z_BUF_ERROR && !m_strm.avail_in)
+				break;
+			if (ret != Z_OK && ret != Z_STREAM_END)
+				throw std::runtime_error("inflate inflate");
+			m_end = ret == Z_STREAM_END;
+			_inflated(out, CHUNK - m_strm.avail_out);
+		}
+		if (m_end && m_strm.avail_in)
+			throw std::runtime_error("inflate trailing");
+	}
+
+	inline oid_t finish()
+	{
+		if (!m_end || !m_hdr_done || m_have != m_size)
+			throw std::runtime_error("loose incomplete");
+		unsigned char raw[GIT_OID_RAWSZ] = {};
+		m_sha.finish(raw);
+		return oid_t::fromraw(raw);
+	}
+
+	inline void _inflated(const char *data, size_t len)
+	{
+		m_sha.update(data, len);
+		if (!m_hdr_done) {
+			const size_t hdrlen = std::find(data, data + len, '\0') - data;
+			m_hdr.append(data, hdrlen);
+			if (m_hdr.size() > 32)
+				throw std::runtime_error("loose header");
+			if (hdrlen == len)
+				return;
+			_header();
+			data += hdrlen + 1;
+			len -= hdrlen + 1;
+		}
+		m_have += len;
+		if (m_have > m_size)
+			throw std::runtime_error("loose size");
+		if (m_content && len)
+			m_content(data, len);
+	}
+
+	inline void _header()
+	{
+		/* format: "(type)(space)(number)(NULL)" */
+		const size_t sp = m_hdr.find(' ');
+		if (sp == std::string::npos || sp + 1 == m_hdr.size() || m_hdr.find_first_not_of("0123456789", sp + 1) != std::string::npos)
+			throw std::runtime_error("loose header");
+		m_type = m_hdr.substr(0, sp);
+		git_type2otype(m_type);
+		m_size = std::stoull(m_hdr.substr(sp + 1));
+		m_hdr_done = true;
+	}
+
+	z_stream m_strm;
+	GitSha1 m_sha;
+	std::string m_hdr;
+	bool m_hdr_done;
+	bool m_end;
+	std::string m_type;
+	size_t m_size;
+	size_t m_have;
+	/* optional - receives the object content (past the header) as it is inflated, not yet verified */
+	std::function<void(const char *, size_t)> m_content;
+};
+
 inline bool
 git_tree_entry_filemode_bloblike_is(git_tree *t, size_t i)
 {
@@ -181,10 +398,82 @@ git_odb_exists(git_odb *odb, git_oid obj)
 	return git_odb_exists(odb, &obj);
 }
 
+/* marks those of oids (sorted) present in the pack index - one merge pass over its sorted object names
+   format v2: magic, version, 256 fan-out entries, names (20 bytes each)
+   format v1: 256 fan-out entries, (4 byte offset, name) pairs */
+inline void
+git_packidx_mark(const boost::filesystem::path &idxpath, const std::vector<oid_t> &oids, std::vector<bool> *found)
+{
+	std::ifstream ff(idxpath.string().c_str(), std::ios::in | std::ios::binary);
+	char hdr[8] = {};
+	if (!ff.read(hdr, sizeof hdr))
+		throw std::runtime_error("pack idx");
+	const bool v2 = memcmp(hdr, "\377tOc\0\0\0\2", sizeof hdr) == 0;
+	if (!v2)
+		ff.seekg(0);
+	unsigned char fanout[256 * 4] = {};
+	if (!ff.read((char *) fanout, sizeof fanout))
+		throw std::runtime_error("pack idx");
+	const size_t n = (size_t) fanout[255 * 4] << 24 | fanout[255 * 4 + 1] << 16 | fanout[255 * 4 + 2] << 8 | fanout[255 * 4 + 3];
+	const size_t stride = v2 ? GIT_OID_RAWSZ : 4 + GIT_OID_RAWSZ;
+	const size_t nameoff = v2 ? 0 : 4;
+	std::string names(n * stride, '\0');
+	if (!ff.read(&names[0], names.size()))
+		throw std::runtime_error("pack idx");
+	size_t a = 0;
+	for (size_t k = 0; k < oids.size() && a < n; k++) {
+		while (a < n && memcmp(names.data() + a * stride + nameoff, oids[k].m_id.data(), GIT_OID_RAWSZ) < 0)
+			a++;
+		if (a < n && memcmp(names.data() + a * stride + nameoff, oids[k].m_id.data(), GIT_OID_RAWSZ) == 0)
+			(*found)[k] = true;
+	}
+}
+
+/* which of oids are not in the object database - one sweep instead of git_odb_exists per object
+     loose: one directory listing per fan-out bucket that has queries
+     packs: one pass over each pack index
+   whatever the sweep did not find is confirmed through the odb (alternates, other backends) - that costs per missing object only
+   returns the missing oids sorted */
+inline std::vector<oid_t>
+git_odb_missing(git_odb *odb, const boost::filesystem::path &objdir, std::vector<oid_t> oids)
+{
+	std::sort(oids.begin(), oids.end());
+	oids.erase(std::unique(oids.begin(), oids.end()), oids.end());
+	std::vector<bool> found(oids.size());
+
+	for (size_t i = 0, j = 0; i < oids.size(); i = j) {
+		while (j < oids.size() && oids[j].m_id[0] == oids[i].m_id[0])
+			j++;
+		const boost::filesystem::path bucket = objdir / oids[i].hex().substr(0, 2);
+		if (!boost::filesystem::is_directory(bucket))
+			continue;
+		std::set<std::string> names;
+		for (const auto &e : boost::filesystem::directory_iterator(bucket))
+			names.insert(e.path().filename().string());
+		for (size_t k = i; k < j; k++)
+			if (names.count(oids[k].hex().substr(2)))
+				found[k] = true;
+	}
+
+	if (boost::filesystem::is_directory(objdir / "pack"))
+		for (const auto &e : boost::filesystem::directory_iterator(objdir / "pack"))
+			if (e.path().extension() == ".idx")
+				git_packidx_mark(e.path(), oids, &found);
+
+	std::vector<oid_t> mis;
+	for (size_t k = 0; k < oids.size(); k++)
+		if (!found[k] && !git_odb_exists(odb, git_oidt2bin(oids[k])))
+			mis.push_back(oids[k]);
+	return mis;
+}
+
 inline void blob_delete(git_blob *p) { if (p) git_blob_free(p); }
 inline void buf_delete(git_buf *p) { if (p) { git_buf_dispose(p); delete p; } }
 inline void commit_delete(git_commit *p) { if (p) git_commit_free(p); }
+inline void diff_delete(git_diff *p) { if (p) git_diff_free(p); }
+inline void indexer_delete(git_indexer *p) { if (p) git_indexer_free(p); }
 inline void odb_delete(git_odb *p) { if (p) git_odb_free(p); }
+inline void odbstream_delete(git_odb_stream *p) { if (p) git_odb_stream_free(p); }
 inline void repo_delete(git_repository *p) { if (p) git_repository_free(p); }
 inline void sig_delete(git_signature *p) { if (p) git_signature_free(p); }
 inline void tree_delete(git_tree *p) { if (p) git_tree_free(p); }
@@ -213,6 +502,25 @@ commit_lookup(git_repository *repo, const git_oid oid)
 	return unique_ptr_gitcommit(p, commit_delete);
 }
 
+inline unique_ptr_gitdiff
+diff_tree_to_tree(git_repository *repo, git_tree *old_tree, git_tree *new_tree)
+{
+	git_diff *p = nullptr;
+	if (!!git_diff_tree_to_tree(&p, repo, old_tree, new_tree, nullptr))
+		throw std::runtime_error("diff tree to tree");
+	return unique_ptr_gitdiff(p, diff_delete);
+}
+
+inline unique_ptr_gitindexer
+indexer_new(const std::string &packdir, git_odb *odb)
+{
+	git_indexer *p = nullptr;
+	git_indexer_options opts = GIT_INDEXER_OPTIONS_INIT;
+	if (!!git_indexer_new(&p, packdir.c_str(), 0, odb, &opts))
+		throw std::runtime_error("indexer new");
+	return unique_ptr_gitindexer(p, indexer_delete);
+}
+
 inline unique_ptr_gitodb
 odb_from_repo(git_repository *repo)
 {
@@ -251,11 +559,11 @@ tree_lookup(git_repository *repo, const git_oid oid)
 }
 
 inline std::vector<unique_ptr_gittree>
-tree_lookup_v(git_repository *repo, const std::vector<shahex_t> &oids)
+tree_lookup_v(git_repository *repo, const std::vector<oid_t> &oids)
 {
 	std::vector<unique_ptr_gittree> trees;
 	for (const auto &a : oids)
-		trees.push_back(tree_lookup(repo, git_hex2bin(a)));
+		trees.push_back(tree_lookup(repo, git_oidt2bin(a)));
 	return trees;
 }
 
@@ -276,8 +584,40 @@ git_repository_ensure(const std::string &repopath)
 	return unique_ptr_gitrepository(repo, repo_delete);
 }
 
+/* indexer verifies the pack checksum and every object hash, writing .pack/.idx into objects/pack
+     odb given so thin packs (deltas against objects already present) resolve
+   the pack is appended piecewise as it arrives */
+class GitPackIngester
+{
+public:
+	inline GitPackIngester(git_repository *repo, git_odb *odb) :
+		m_odb(odb),
+		m_idx(indexer_new((boost::filesystem::path(git_repository_path(repo)) / "objects" / "pack").string(), m_odb)),
+		m_stats()
+	{}
+
+	inline void append(const char *data, size_t len)
+	{
+		if (!!git_indexer_append(m_idx.get(), data, len, &m_stats))
+			throw std::runtime_error("indexer append");
+	}
+
+	inline void commit()
+	{
+		if (!!git_indexer_commit(m_idx.get(), &m_stats))
+			throw std::runtime_error("indexer commit");
+		/* odb caches its pack list */
+		if (!!git_odb_refresh(m_odb))
+			throw std::runtime_error("odb refresh");
+	}
+
+	git_odb *m_odb;
+	unique_ptr_gitindexer m_idx;
+	git_transfer_progress m_stats;
+};
+
 inline void
-git_checkout_obj(git_repository *repo, const shahex_t &tree, const std::string &chkoutdir)
+git_checkout_obj(git_repository *repo, const oid_t &tree, const std::string &chkoutdir)
 {
 	cruft_regex_search("chk", chkoutdir);
 	// FIXME: consider GIT_CHECKOUT_REMOVE_UNTRACKED
@@ -285,11 +625,270 @@ git_checkout_obj(git_repository *repo, const shahex_t &tree, const std::string &
 	opts.checkout_strategy = GIT_CHECKOUT_FORCE;
 	opts.disable_filters = 1;
 	opts.target_directory = chkoutdir.c_str();
-	unique_ptr_gittree _tree(tree_lookup(repo, git_hex2bin(tree)));
+	unique_ptr_gittree _tree(tree_lookup(repo, git_oidt2bin(tree)));
 	if (!!git_checkout_tree(repo, (git_object *) _tree.get(), &opts))
 		throw std::runtime_error("checkout tree");
 }
 
+/* one file of a checkout - path relative to the checkout directory, '/' separated */
+class GitCheckoutItem
+{
+public:
+	inline GitCheckoutItem(const std::string &path, const oid_t &oid, uint32_t mode) :
+		m_path(path),
+		m_oid(oid),
+		m_mode(mode)
+	{}
+
+	std::string m_path;
+	oid_t m_oid;
+	uint32_t m_mode;
+};
+
+/* every entry below tree (depth first) */
+inline void
+git_checkout_items_full(git_repository *repo, const oid_t &tree, const std::string &prefix, std::vector<GitCheckoutItem> *items)
+{
+	unique_ptr_gittree t(tree_lookup(repo, git_oidt2bin(tree)));
+	for (size_t i = 0; i < git_tree_entrycount(t.get()); i++) {
+		const git_tree_entry *e = git_tree_entry_byindex(t.get(), i);
+		const std::string path = prefix + git_tree_entry_name(e);
+		if (git_tree_entry_filemode(e) == GIT_FILEMODE_TREE)
+			git_checkout_items_full(repo, git_bin2oidt(*git_tree_entry_id(e)), path + "/", items);
+		else
+			items->push_back(GitCheckoutItem(path, git_bin2oidt(*git_tree_entry_id(e)), git_tree_entry_filemode(e)));
+	}
+}
+
+/* the entries of the tree-to-tree diff - written (added, changed) into items, removed (deleted, type changed) into removes */
+inline void
+git_checkout_items_diff(git_repository *repo, const oid_t &oldtree, const oid_t &tree, std::vector<GitCheckoutItem> *items, std::vector<std::string> *removes)
+{
+	unique_ptr_gittree _oldtree(tree_lookup(repo, git_oidt2bin(oldtree)));
+	unique_ptr_gittree _tree(tree_lookup(repo, git_oidt2bin(tree)));
+	unique_ptr_gitdiff diff(diff_tree_to_tree(repo, _oldtree.get(), _tree.get()));
+	for (size_t i = 0; i < git_diff_num_deltas(diff.get()); i++) {
+		const git_diff_delta *d = git_diff_get_delta(diff.get(), i);
+		if (d->status == GIT_DELTA_DELETED || d->status == GIT_DELTA_TYPECHANGE)
+			removes->push_back(d->old_file.path);
+		if (d->status != GIT_DELTA_DELETED)
+			items->push_back(GitCheckoutItem(d->new_file.path, git_bin2oidt(d->new_file.id), d->new_file.mode));
+	}
+}
+
+/* staging directory of the files of a checkout - beside chkoutdir, not inside it (no tree path collides with a staging file)
+   on the same volume as chkoutdir - moving a staged file into place stays a rename */
+inline boost::filesystem::path
+git_checkout_stage_dir(const boost::filesystem::path &chkoutdir)
+{
+	std::string dir = chkoutdir.string();
+	while (dir.size() > 1 && (dir.back() == '/' || dir.back() == '\\'))
+		dir.pop_back();
+	return dir + ".pstmp";
+}
+
+/* content of blob to stagepath then renamed over chkoutdir/path (as cruft_file_write_moving, without the trip through the temp directory)
+   streamed off the odb a chunk at a time where the backend can (loose objects) - memory does not grow with the blob
+   read whole otherwise (packs) */
+inline void
+git_checkout_item_write(git_repository *repo, git_odb *odb, const boost::filesystem::path &chkoutdir, const boost::filesystem::path &stagepath, const GitCheckoutItem &item)
+{
+	const size_t CHUNK = 65536;
+	const boost::filesystem::path finalpath = chkoutdir / item.m_path;
+	/* a directory where the file goes (full checkout over another tree) */
+	if (boost::filesystem::is_directory(finalpath))
+		boost::filesystem::remove_all(finalpath);
+	{
+		std::ofstream ff(stagepath.string().c_str(), std::ios::out | std::ios::trunc | std::ios::binary);
+		const git_oid oid = git_oidt2bin(item.m_oid);
+		git_odb_stream *p = nullptr;
+		size_t len = 0;
+		git_otype type = GIT_OBJ_BAD;
+		if (!git_odb_open_rstream(&p, &len, &type, odb, &oid)) {
+			unique_ptr_gitodbstream strm(p, odbstream_delete);
+			if (type != GIT_OBJ_BLOB)
+				throw std::runtime_error("checkout type");
+			std::vector<char> chunk(CHUNK);
+			size_t have = 0;
+			int n = 0;
+			while ((n = git_odb_stream_read(strm.get(), chunk.data(), chunk.size())) > 0) {
+				ff.write(chunk.data(), n);
+				have += (size_t) n;
+			}
+			if (n < 0 || have != len)
+				throw std::runtime_error("checkout read");
+		}
+		else {
+			unique_ptr_gitblob blob(blob_lookup(repo, oid));
+			ff.write((const char *) git_blob_rawcontent(blob.get()), (std::streamsize) git_blob_rawsize(blob.get()));
+		}
+		ff.flush();
+		if (!ff.good())
+			throw std::runtime_error("checkout write");
+	}
+	if (item.m_mode == GIT_FILEMODE_BLOB_EXECUTABLE)
+		boost::filesystem::permissions(stagepath, boost::filesystem::add_perms | boost::filesystem::owner_exe | boost::filesystem::group_exe | boost::filesystem::others_exe);
+	cruft_rename_file_file(stagepath.string(), finalpath.string());
+}
+
+/* tree entry path safe to join onto the checkout directory - the checks git_checkout_tree would otherwise do
+     relative, no empty, "." or ".." component, no ".git" (nor its windows aliases - trailing dots and spaces dropped, short name)
+     no backslash or colon - separator and drive (or stream) on windows */
+inline bool
+git_checkout_path_safe(const std::string &path)
+{
+	if (path.empty() || path.find_first_of("\\:") != std::string::npos)
+		return false;
+	for (size_t beg = 0, end = 0; end != std::string::npos; beg = end + 1) {
+		end = path.find('/', beg);
+		std::string comp = path.substr(beg, end == std::string::npos ? std::string::npos : end - beg);
+		while (!comp.empty() && (comp.back() == '.' || comp.back() == ' '))
+			comp.pop_back();
+		std::transform(comp.begin(), comp.end(), comp.begin(), [](char c) { return (char) tolower((unsigned char) c); });
+		if (comp.empty() || comp == ".git" || comp == "git~1")
+			return false;
+	}
+	return true;
+}
+
+/* removes, then the directories of items - everything git_checkout_parallel_write (or a fused fetch) needs in place
+     removed files take their emptied directories with them, a file where a directory of items goes is removed
+     the staging directory starts out empty (see git_checkout_stage_dir) - whatever an interrupted checkout left is dropped
+   throws before touching anything if a path would leave dir (see git_checkout_path_safe) */
+inline void
+git_checkout_parallel_prepare(const boost::filesystem::path &dir, const std::vector<std::string> &removes, const std::vector<GitCheckoutItem> &items)
+{
+	cruft_regex_search("chk", dir.string());
+	for (const auto &remove : removes)
+		if (!git_checkout_path_safe(remove))
+			throw std::runtime_error("checkout path");
+	for (const auto &item : items)
+		if (!git_checkout_path_safe(item.m_path))
+			throw std::runtime_error("checkout path");
+	for (const auto &remove : removes) {
+		boost::filesystem::path path = dir / remove;
+		boost::filesystem::remove(path);
+		for (path = path.parent_path(); path != dir && boost::filesystem::is_directory(path) && boost::filesystem::is_empty(path); path = path.parent_path())
+			boost::filesystem::remove(path);
+	}
+
+	std::set<std::string> dirs;
+	for (const auto &item : items)
+		dirs.insert(boost::filesystem::path(item.m_path).parent_path().string());
+	boost::filesystem::create_directories(dir);
+	for (const auto &d : dirs) {
+		if (d.empty())
+			continue;
+		/* a file where the directory (or one of its parents) goes (full checkout over another tree) */
+		for (boost::filesystem::path p = dir / d; p != dir; p = p.parent_path())
+			if (boost::filesystem::exists(p) && !boost::filesystem::is_directory(p))
+				boost::filesystem::remove(p);
+		boost::filesystem::create_directories(dir / d);
+	}
+
+	boost::filesystem::remove_all(git_checkout_stage_dir(dir));
+	boost::filesystem::create_directories(git_checkout_stage_dir(dir));
+}
+
+/* items written by nthreads threads - their directories already created (see git_checkout_parallel_prepare)
+     each thread reads blobs through its own repository (libgit2 handles are not shared across threads), inflating concurrently
+     items are taken off a shared counter - a large blob holds up one thread, not a fixed share of the work
+     item i is staged as (staging directory)/i, the staging directory is removed once all are in place */
+inline void
+git_checkout_parallel_write(git_repository *repo, const boost::filesystem::path &dir, const std::vector<GitCheckoutItem> &items, size_t nthreads)
+{
+	const std::string repopath(git_repository_path(repo));
+	const boost::filesystem::path stagedir = git_checkout_stage_dir(dir);
+	std::atomic<size_t> next(0);
+	std::vector<std::exception_ptr> excs(nthreads);
+	std::vector<std::thread> thrs;
+	for (size_t t = 0; t < nthreads; t++)
+		thrs.push_back(std::thread([&, t]() {
+			try {
+				unique_ptr_gitrepository threpo(repository_open(repopath));
+				unique_ptr_gitodb thodb(odb_from_repo(threpo.get()));
+				for (size_t i; (i = next++) < items.size();)
+					git_checkout_item_write(threpo.get(), thodb.get(), dir, stagedir / std::to_string(i), items[i]);
+			}
+			catch (...) {
+				excs[t] = std::current_exception();
+				/* the others stop at their next item */
+				next = items.size();
+			}
+		}));
+	for (auto &thr : thrs)
+		thr.join();
+	for (const auto &exc : excs)
+		if (exc)
+			std::rethrow_exception(exc);
+	boost::filesystem::remove_all(stagedir);
+}
+
+inline bool
+git_checkout_items_files_are(const std::vector<GitCheckoutItem> &items)
+{
+	for (const auto &item : items)
+		if (item.m_mode != GIT_FILEMODE_BLOB && item.m_mode != GIT_FILEMODE_BLOB_EXECUTABLE)
+			return false;
+	return true;
+}
+
+/* removes, then items written by nthreads threads (see git_checkout_parallel_prepare, git_checkout_parallel_write)
+   false (nothing touched) for entries other than files - symlinks and submodules are left to git_checkout_tree */
+inline bool
+git_checkout_parallel(git_repository *repo, const std::string &chkoutdir, const std::vector<std::string> &removes, const std::vector<GitCheckoutItem> &items, size_t nthreads)
+{
+	if (!git_checkout_items_files_are(items))
+		return false;
+	git_checkout_parallel_prepare(chkoutdir, removes, items);
+	git_checkout_parallel_write(repo, chkoutdir, items, nthreads);
+	return true;
+}
+
+/* paths added, removed or changed (content or mode) going from oldtree to tree - no rename detection, a rename is a removal and an addition */
+inline std::vector<std::string>
+git_diff_tree_paths(git_repository *repo, const oid_t &oldtree, const oid_t &tree)
+{
+	unique_ptr_gittree _oldtree(tree_lookup(repo, git_oidt2bin(oldtree)));
+	unique_ptr_gittree _tree(tree_lookup(repo, git_oidt2bin(tree)));
+	unique_ptr_gitdiff diff(diff_tree_to_tree(repo, _oldtree.get(), _tree.get()));
+	std::vector<std::string> paths;
+	for (size_t i = 0; i < git_diff_num_deltas(diff.get()); i++) {
+		const git_diff_delta *d = git_diff_get_delta(diff.get(), i);
+		paths.push_back(d->status == GIT_DELTA_DELETED ? d->old_file.path : d->new_file.path);
+	}
+	return paths;
+}
+
+/* as git_checkout_obj for a chkoutdir holding oldtree (as checked out by an earlier git_checkout_obj / git_checkout_obj_diff)
+     only the paths of the tree-to-tree diff are written or removed - with oldtree as baseline libgit2 removes what tree dropped
+     files outside the diff are not looked at, local modifications to them survive (git_checkout_obj would overwrite them)
+   returns the number of paths touched */
+inline size_t
+git_checkout_obj_diff(git_repository *repo, const oid_t &oldtree, const oid_t &tree, const std::string &chkoutdir)
+{
+	cruft_regex_search("chk", chkoutdir);
+	const std::vector<std::string> paths = git_diff_tree_paths(repo, oldtree, tree);
+	if (paths.empty())
+		return 0;
+	std::vector<char *> strings;
+	for (const auto &path : paths)
+		strings.push_back(const_cast<char *>(path.c_str()));
+	git_checkout_options opts = GIT_CHECKOUT_OPTIONS_INIT;
+	/* paths are exact, not pathspecs */
+	opts.checkout_strategy = GIT_CHECKOUT_FORCE | GIT_CHECKOUT_DISABLE_PATHSPEC_MATCH;
+	opts.disable_filters = 1;
+	opts.target_directory = chkoutdir.c_str();
+	opts.paths.strings = strings.data();
+	opts.paths.count = strings.size();
+	unique_ptr_gittree _oldtree(tree_lookup(repo, git_oidt2bin(oldtree)));
+	unique_ptr_gittree _tree(tree_lookup(repo, git_oidt2bin(tree)));
+	opts.baseline = _oldtree.get();
+	if (!!git_checkout_tree(repo, (git_object *) _tree.get(), &opts))
+		throw std::runtime_error("checkout tree diff");
+	return paths.size();
+}
+
 }
 
 #endif /* _PSGIT_HPP_ */
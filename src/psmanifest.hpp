@@ -0,0 +1,143 @@
+#ifndef _PSMANIFEST_HPP_
+#define _PSMANIFEST_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include <boost/filesystem.hpp>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <psmisc.hpp>
+
+namespace ps
+{
+
+/* release manifest of a commit - written by manifest_write of coor.py, served at /manifest/(commit hex)
+     header (40 bytes): "PSMF", u32 version, u32 count, u32 path bytes, commit (20 bytes raw), 4 bytes padding
+     count records (48 bytes each), sorted by path (bytewise): u32 path offset, u32 path length, u32 mode, oid (20 bytes raw), u64 size, u64 compressed size
+     the paths, concatenated ('/' separated, the root tree has the empty path)
+   integers little endian, compressed size zero if unknown
+   mapped read-only, entries decoded on access - validated once at construction so lookups need no bounds checks */
+class UpdaterManifestEntry
+{
+public:
+	inline UpdaterManifestEntry() :
+		m_path(),
+		m_mode(0),
+		m_oid(),
+		m_size(0),
+		m_csize(0)
+	{}
+
+	std::string m_path;
+	uint32_t m_mode;
+	oid_t m_oid;
+	uint64_t m_size;
+	uint64_t m_csize;
+};
+
+class UpdaterManifest
+{
+public:
+	static const uint32_t VERSION = 1;
+	static const size_t HEADSZ = 40;
+	static const size_t RECSZ = 48;
+
+	inline UpdaterManifest(const boost::filesystem::path &path) :
+		m_file(path.string().c_str(), boost::interprocess::read_only),
+		m_region(m_file, boost::interprocess::read_only),
+		m_data((const unsigned char *) m_region.get_address()),
+		m_len(m_region.get_size()),
+		m_count(0),
+		m_paths(nullptr),
+		m_pathsz(0),
+		m_commit()
+	{
+		if (m_len < HEADSZ || memcmp(m_data, "PSMF", 4) != 0 || _u32(m_data + 4) != VERSION)
+			throw std::runtime_error("manifest header");
+		m_count = _u32(m_data + 8);
+		m_pathsz = _u32(m_data + 12);
+		m_commit = oid_t::fromraw(m_data + 16);
+		if (m_len != HEADSZ + (uint64_t) m_count * RECSZ + m_pathsz)
+			throw std::runtime_error("manifest size");
+		m_paths = (const char *) m_data + HEADSZ + m_count * RECSZ;
+		for (size_t i = 0; i < m_count; i++) {
+			const unsigned char *rec = _rec(i);
+			if ((uint64_t) _u32(rec) + _u32(rec + 4) > m_pathsz)
+				throw std::runtime_error("manifest path");
+			if (i && _pathcmp(i - 1, _path(i)) >= 0)
+				throw std::runtime_error("manifest order");
+		}
+	}
+
+	inline size_t size() const { return m_count; }
+
+	inline UpdaterManifestEntry entry(size_t i) const
+	{
+		const unsigned char *rec = _rec(i);
+		UpdaterManifestEntry e;
+		e.m_path = _path(i);
+		e.m_mode = _u32(rec + 8);
+		e.m_oid = oid_t::fromraw(rec + 12);
+		e.m_size = _u64(rec + 32);
+		e.m_csize = _u64(rec + 40);
+		return e;
+	}
+
+	/* binary search by path */
+	inline bool find(const std::string &path, UpdaterManifestEntry *e) const
+	{
+		size_t lo = 0, hi = m_count;
+		while (lo < hi) {
+			const size_t mid = lo + (hi - lo) / 2;
+			if (_pathcmp(mid, path) < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if (lo == m_count || _pathcmp(lo, path) != 0)
+			return false;
+		*e = entry(lo);
+		return true;
+	}
+
+	inline const unsigned char * _rec(size_t i) const { return m_data + HEADSZ + i * RECSZ; }
+
+	inline std::string _path(size_t i) const { return std::string(m_paths + _u32(_rec(i)), _u32(_rec(i) + 4)); }
+
+	/* bytewise, as the paths were sorted */
+	inline int _pathcmp(size_t i, const std::string &path) const
+	{
+		const char *p = m_paths + _u32(_rec(i));
+		const size_t n = _u32(_rec(i) + 4);
+		const int r = memcmp(p, path.data(), std::min(n, path.size()));
+		return r ? r : n < path.size() ? -1 : n > path.size() ? 1 : 0;
+	}
+
+	inline static uint32_t _u32(const unsigned char *p)
+	{
+		return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+	}
+
+	inline static uint64_t _u64(const unsigned char *p)
+	{
+		return (uint64_t) _u32(p) | (uint64_t) _u32(p + 4) << 32;
+	}
+
+	boost::interprocess::file_mapping m_file;
+	boost::interprocess::mapped_region m_region;
+	const unsigned char *m_data;
+	size_t m_len;
+	size_t m_count;
+	const char *m_paths;
+	size_t m_pathsz;
+	oid_t m_commit;
+};
+
+}
+
+#endif /* _PSMANIFEST_HPP_ */
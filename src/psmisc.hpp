@@ -1,7 +1,12 @@
 #ifndef _PSMISC_HPP_
 #define _PSMISC_HPP_
 
+#include <array>
+#include <cstddef>
+#include <cstring>
+#include <functional>
 #include <memory>
+#include <stdexcept>
 #include <string>
 
 template<typename T>
@@ -12,4 +17,74 @@ using up = ::std::unique_ptr<T>;
 
 using shahex_t = ::std::string;
 
+/* object id as its 20 raw bytes - hex only at the edges (request paths, refs, logging) */
+class oid_t
+{
+public:
+	static const size_t RAWSZ = 20;
+
+	inline oid_t() :
+		m_id()
+	{}
+
+	inline static oid_t fromraw(const unsigned char *raw)
+	{
+		oid_t oid;
+		memcpy(oid.m_id.data(), raw, RAWSZ);
+		return oid;
+	}
+
+	inline static oid_t fromhex(const std::string &hex)
+	{
+		oid_t oid;
+		if (hex.size() != 2 * RAWSZ)
+			throw std::runtime_error("oid");
+		for (size_t i = 0; i < RAWSZ; i++)
+			oid.m_id[i] = (unsigned char) (_nibble(hex[2 * i]) << 4 | _nibble(hex[2 * i + 1]));
+		return oid;
+	}
+
+	inline std::string hex() const
+	{
+		const char *digits = "0123456789abcdef";
+		std::string hex(2 * RAWSZ, '\0');
+		for (size_t i = 0; i < RAWSZ; i++) {
+			hex[2 * i] = digits[m_id[i] >> 4];
+			hex[2 * i + 1] = digits[m_id[i] & 0xF];
+		}
+		return hex;
+	}
+
+	inline bool operator==(const oid_t &other) const { return m_id == other.m_id; }
+	inline bool operator!=(const oid_t &other) const { return m_id != other.m_id; }
+	inline bool operator<(const oid_t &other) const { return m_id < other.m_id; }
+
+	inline static int _nibble(char c)
+	{
+		if (c >= '0' && c <= '9') return c - '0';
+		if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+		if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+		throw std::runtime_error("oid");
+	}
+
+	std::array<unsigned char, RAWSZ> m_id;
+};
+
+namespace std
+{
+
+/* ids are SHA-1 - any machine word of them is already uniformly distributed */
+template<>
+struct hash<oid_t>
+{
+	inline size_t operator()(const oid_t &oid) const
+	{
+		size_t h = 0;
+		memcpy(&h, oid.m_id.data(), sizeof h);
+		return h;
+	}
+};
+
+}
+
 #endif /* _PSMISC_HPP_ */
@@ -0,0 +1,144 @@
+#ifndef _PSSCHED_HPP_
+#define _PSSCHED_HPP_
+
+#include <algorithm>
+#include <cstdint>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <psmisc.hpp>
+
+namespace ps
+{
+
+/* one object waiting to be fetched
+     size - expected download size, zero if unknown
+     path - checkout-relative path ('/' separated), empty if unknown (trees, delta lists) */
+class UpdaterSchedItem
+{
+public:
+	inline UpdaterSchedItem(const oid_t &obj, uint64_t size = 0, const std::string &path = std::string()) :
+		m_obj(obj),
+		m_size(size),
+		m_path(path)
+	{}
+
+	oid_t m_obj;
+	uint64_t m_size;
+	std::string m_path;
+};
+
+/* fetch order - a strict weak ordering, items neither before the other go first come first served */
+class UpdaterSchedPolicy
+{
+public:
+	inline virtual ~UpdaterSchedPolicy() {};
+	inline virtual bool before(const UpdaterSchedItem &a, const UpdaterSchedItem &b) const = 0;
+};
+
+class UpdaterSchedFifo : public UpdaterSchedPolicy
+{
+public:
+	inline virtual bool before(const UpdaterSchedItem &, const UpdaterSchedItem &) const override { return false; }
+};
+
+/* the big blobs bound the tail of the download - start them while the small ones fill the gaps */
+class UpdaterSchedLargest : public UpdaterSchedPolicy
+{
+public:
+	inline virtual bool before(const UpdaterSchedItem &a, const UpdaterSchedItem &b) const override { return a.m_size > b.m_size; }
+};
+
+/* classes: critical paths (updater and stage2 - self-update can proceed), then large, then small - largest first within a class */
+class UpdaterSchedCritical : public UpdaterSchedPolicy
+{
+public:
+	inline UpdaterSchedCritical(const std::vector<std::string> &critical, uint64_t large) :
+		m_critical(critical),
+		m_large(large)
+	{}
+
+	inline virtual bool before(const UpdaterSchedItem &a, const UpdaterSchedItem &b) const override
+	{
+		const int ca = cls(a), cb = cls(b);
+		return ca != cb ? ca < cb : a.m_size > b.m_size;
+	}
+
+	inline int cls(const UpdaterSchedItem &item) const
+	{
+		if (item.m_path.size() && std::find(m_critical.begin(), m_critical.end(), item.m_path) != m_critical.end())
+			return 0;
+		return item.m_size >= m_large ? 1 : 2;
+	}
+
+	std::vector<std::string> m_critical;
+	uint64_t m_large;
+};
+
+inline sp<UpdaterSchedPolicy>
+updater_sched_policy_create(const std::string &name, const std::vector<std::string> &critical, uint64_t large)
+{
+	if (name == "fifo")
+		return sp<UpdaterSchedPolicy>(new UpdaterSchedFifo());
+	if (name == "largest")
+		return sp<UpdaterSchedPolicy>(new UpdaterSchedLargest());
+	if (name == "critical")
+		return sp<UpdaterSchedPolicy>(new UpdaterSchedCritical(critical, large));
+	throw std::runtime_error("sched policy");
+}
+
+/* items ordered by policy, ties by arrival - not synchronized (see UpdaterFetchPool) */
+class UpdaterSchedQueue
+{
+public:
+	class Entry
+	{
+	public:
+		UpdaterSchedItem m_item;
+		uint64_t m_seq;
+	};
+
+	class Less
+	{
+	public:
+		inline bool operator()(const Entry &a, const Entry &b) const
+		{
+			if (m_policy->before(a.m_item, b.m_item))
+				return true;
+			if (m_policy->before(b.m_item, a.m_item))
+				return false;
+			return a.m_seq < b.m_seq;
+		}
+
+		const UpdaterSchedPolicy *m_policy;
+	};
+
+	inline UpdaterSchedQueue(const sp<UpdaterSchedPolicy> &policy) :
+		m_policy(policy),
+		m_seq(0),
+		m_set(Less{ m_policy.get() })
+	{}
+
+	inline void push(const UpdaterSchedItem &item) { m_set.insert(Entry{ item, m_seq++ }); }
+
+	inline UpdaterSchedItem pop()
+	{
+		const UpdaterSchedItem item = m_set.begin()->m_item;
+		m_set.erase(m_set.begin());
+		return item;
+	}
+
+	inline size_t size() const { return m_set.size(); }
+	inline bool empty() const { return m_set.empty(); }
+	inline void clear() { m_set.clear(); }
+
+	sp<UpdaterSchedPolicy> m_policy;
+	uint64_t m_seq;
+	std::set<Entry, Less> m_set;
+};
+
+}
+
+#endif /* _PSSCHED_HPP_ */
@@ -0,0 +1,620 @@
+#ifndef _PSSERV_HPP_
+#define _PSSERV_HPP_
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <stdexcept>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/beast.hpp>
+#include <boost/filesystem.hpp>
+
+#include <psasio.hpp>
+#include <pscruft.hpp>
+#include <psmisc.hpp>
+
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <unistd.h>
+#endif
+
+namespace ps
+{
+
+using serv_tcp = ::boost::asio::ip::tcp;
+namespace serv_http = ::boost::beast::http;
+
+/* exactly "/objects/(xx)/(38 hex)" - unlike con_objpath_parse nothing may precede or follow */
+inline bool
+serv_objpath_parse(const std::string &target, std::string *hex)
+{
+	const std::string pfx = "/objects/";
+	if (target.size() != pfx.size() + 2 + 1 + 38 || target.compare(0, pfx.size(), pfx) != 0 || target[pfx.size() + 2] != '/')
+		return false;
+	*hex = target.substr(pfx.size(), 2) + target.substr(pfx.size() + 3, 38);
+	return hex->find_first_not_of("0123456789abcdefABCDEF") == std::string::npos;
+}
+
+/* "/manifest/(40 hex)" */
+inline bool
+serv_manifestpath_parse(const std::string &target, std::string *hex)
+{
+	const std::string pfx = "/manifest/";
+	if (target.size() != pfx.size() + 40 || target.compare(0, pfx.size(), pfx) != 0)
+		return false;
+	*hex = boost::algorithm::to_lower_copy(target.substr(pfx.size()));
+	return hex->find_first_not_of("0123456789abcdef") == std::string::npos;
+}
+
+/* "/refs/heads/(name)" - name a single path component */
+inline bool
+serv_refpath_parse(const std::string &target, std::string *name)
+{
+	const std::string pfx = "/refs/heads/";
+	if (target.compare(0, pfx.size(), pfx) != 0)
+		return false;
+	*name = target.substr(pfx.size());
+	return name->size() && name->find_first_not_of("0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ._-") == std::string::npos && *name != "." && *name != "..";
+}
+
+/* start of a "Range: bytes=(start)-" request, size (whole body) if none - a start at or past the end is ignored too (see server_range_start of server.py) */
+inline uint64_t
+serv_range_start(const std::string &range, uint64_t size)
+{
+	const std::string pfx = "bytes=";
+	if (range.size() < pfx.size() + 2 || range.compare(0, pfx.size(), pfx) != 0 || range.back() != '-')
+		return size;
+	const std::string num = range.substr(pfx.size(), range.size() - pfx.size() - 1);
+	if (num.size() > 19 || num.find_first_not_of("0123456789") != std::string::npos)
+		return size;
+	const uint64_t start = std::stoull(num);
+	return start < size ? start : size;
+}
+
+/* If-None-Match naming etag (or any) */
+inline bool
+serv_etag_match(const std::string &inm, const std::string &etag)
+{
+	std::vector<std::string> tags;
+	boost::split(tags, inm, boost::is_any_of(","));
+	for (auto &tag : tags) {
+		boost::trim(tag);
+		if (tag == etag || tag == "*")
+			return true;
+	}
+	return false;
+}
+
+/* loose object bytes (as on disk, compressed) by oid, least recently used evicted past the byte capacity
+     sharded by oid - a request locks only its shard, the hot set of a release is read by every client at once
+     objects over a shard's capacity / 8 are not cached (sendfile serves them as well from the page cache)
+   counters are totals since construction - a lookup not found is counted once its size is known (see missed)
+     as a miss if the object could have been cached, as oversize if not - the hit ratio is over what the cache can hold */
+class ServCache
+{
+public:
+	typedef std::list<std::pair<oid_t, sp<const std::string> > > lru_t;
+
+	class Shard
+	{
+	public:
+		inline Shard() :
+			m_mutex(),
+			m_lru(),
+			m_map(),
+			m_bytes(0)
+		{}
+
+		std::mutex m_mutex;
+		lru_t m_lru;
+		std::unordered_map<oid_t, lru_t::iterator> m_map;
+		size_t m_bytes;
+	};
+
+	inline ServCache(size_t capacity, size_t nshards = 16) :
+		m_nshards(std::max<size_t>(nshards, 1)),
+		m_shardcap(capacity / m_nshards),
+		m_objmax(m_shardcap / 8),
+		m_shards(),
+		m_hits(0),
+		m_misses(0),
+		m_oversize(0),
+		m_insertions(0),
+		m_evictions(0)
+	{
+		for (size_t i = 0; i < m_nshards; i++)
+			m_shards.push_back(up<Shard>(new Shard()));
+	}
+
+	inline Shard & _shard(const oid_t &oid)
+	{
+		/* not the bytes std::hash uses - shards would see correlated buckets */
+		return *m_shards[oid.m_id[oid.m_id.size() - 1] % m_nshards];
+	}
+
+	inline sp<const std::string> get(const oid_t &oid)
+	{
+		Shard &shard = _shard(oid);
+		std::lock_guard<std::mutex> lock(shard.m_mutex);
+		auto it = shard.m_map.find(oid);
+		if (it == shard.m_map.end())
+			return sp<const std::string>();
+		m_hits++;
+		shard.m_lru.splice(shard.m_lru.begin(), shard.m_lru, it->second);
+		return it->second->second;
+	}
+
+	inline void missed(uint64_t size)
+	{
+		if (size > m_objmax)
+			m_oversize++;
+		else
+			m_misses++;
+	}
+
+	inline void put(const oid_t &oid, const sp<const std::string> &data)
+	{
+		if (data->size() > m_objmax)
+			return;
+		Shard &shard = _shard(oid);
+		std::lock_guard<std::mutex> lock(shard.m_mutex);
+		if (shard.m_map.count(oid))
+			return;
+		shard.m_lru.push_front(std::make_pair(oid, data));
+		shard.m_map[oid] = shard.m_lru.begin();
+		shard.m_bytes += data->size();
+		m_insertions++;
+		while (shard.m_bytes > m_shardcap) {
+			shard.m_bytes -= shard.m_lru.back().second->size();
+			shard.m_map.erase(shard.m_lru.back().first);
+			shard.m_lru.pop_back();
+			m_evictions++;
+		}
+	}
+
+	inline std::string stats()
+	{
+		size_t bytes = 0, objects = 0;
+		for (auto &shard : m_shards) {
+			std::lock_guard<std::mutex> lock(shard->m_mutex);
+			bytes += shard->m_bytes;
+			objects += shard->m_map.size();
+		}
+		std::stringstream ss;
+		ss << "hits " << m_hits << "\n"
+			<< "misses " << m_misses << "\n"
+			<< "oversize " << m_oversize << "\n"
+			<< "insertions " << m_insertions << "\n"
+			<< "evictions " << m_evictions << "\n"
+			<< "objects " << objects << "\n"
+			<< "bytes " << bytes << "\n"
+			<< "capacity " << m_shardcap * m_nshards << "\n";
+		return ss.str();
+	}
+
+	size_t m_nshards;
+	size_t m_shardcap;
+	size_t m_objmax;
+	std::vector<up<Shard> > m_shards;
+	std::atomic<uint64_t> m_hits;
+	std::atomic<uint64_t> m_misses;
+	std::atomic<uint64_t> m_oversize;
+	std::atomic<uint64_t> m_insertions;
+	std::atomic<uint64_t> m_evictions;
+};
+
+/* the answer to one request - small bodies in m_res, a file (range) is sent after m_head as it is on disk
+   a cached object is sent from m_data (shared with the cache, not copied) through m_cached */
+class ServReply
+{
+public:
+	inline ServReply() :
+		m_res(),
+		m_head(),
+		m_cached(),
+		m_data(),
+		m_file(),
+		m_offset(0),
+		m_len(0)
+	{}
+
+	inline bool keep_alive() const { return m_data ? m_cached.keep_alive() : m_file.empty() ? m_res.keep_alive() : m_head.keep_alive(); }
+
+	serv_http::response<serv_http::string_body> m_res;
+	serv_http::response<serv_http::empty_body> m_head;
+	serv_http::response<serv_http::span_body<const char> > m_cached;
+	sp<const std::string> m_data;
+	boost::filesystem::path m_file;
+	uint64_t m_offset;
+	uint64_t m_len;
+};
+
+/* the routes of server.py the updater fetches with - objects and refs, GET or POST
+     objects - loose only, resumable with Range, cacheable on GET (see object_get of server.py)
+     refs - the ref file as stored, the commit (as ConFs and /lowtech/refs/ of nginx serve it)
+     manifest - the release manifest of a commit (see manifest_write of coor.py), from disk
+     stats/cache - the counters of cache
+   everything else (delta lists, packs, sizes) stays with server.py - the updater falls back without them
+   cache may be null (every object from disk) */
+inline ServReply
+serv_route(const boost::filesystem::path &gitdir, ServCache *cache, const serv_http::request<serv_http::string_body> &req)
+{
+	ServReply reply;
+	const std::string target(req.target());
+	std::string hex, name;
+	auto small = [&](serv_http::status status, const std::string &body) {
+		reply.m_res = serv_http::response<serv_http::string_body>(status, req.version());
+		reply.m_res.set(serv_http::field::server, BOOST_BEAST_VERSION_STRING);
+		reply.m_res.keep_alive(req.keep_alive());
+		reply.m_res.body() = req.method() == serv_http::verb::head ? std::string() : body;
+		reply.m_res.prepare_payload();
+	};
+
+	if (req.method() != serv_http::verb::get && req.method() != serv_http::verb::head && req.method() != serv_http::verb::post) {
+		small(serv_http::status::method_not_allowed, "");
+		return reply;
+	}
+
+	if (serv_objpath_parse(target, &hex)) {
+		const boost::filesystem::path path = gitdir / "objects" / hex.substr(0, 2) / hex.substr(2);
+		const oid_t oid = oid_t::fromhex(boost::algorithm::to_lower_copy(hex));
+		sp<const std::string> data = cache ? cache->get(oid) : sp<const std::string>();
+		boost::system::error_code ec;
+		const uint64_t size = data ? data->size() : boost::filesystem::file_size(path, ec);
+		if (ec) {
+			small(serv_http::status::not_found, "");
+			return reply;
+		}
+		if (!data && cache)
+			cache->missed(size);
+		if (!data && cache && size <= cache->m_objmax) {
+			try {
+				data = sp<const std::string>(new std::string(cruft_file_read(path)));
+			}
+			catch (std::exception &) {
+				small(serv_http::status::not_found, "");
+				return reply;
+			}
+			/* not yet fully written - the (atomic, moving) writer of the repository never leaves one, but do not cache it */
+			if (data->size() != size)
+				data.reset();
+			else
+				cache->put(oid, data);
+		}
+		const bool get = req.method() != serv_http::verb::post;
+		const std::string etag = "\"" + boost::algorithm::to_lower_copy(hex) + "\"";
+		if (get && serv_etag_match(std::string(req[serv_http::field::if_none_match]), etag)) {
+			small(serv_http::status::not_modified, "");
+			reply.m_res.set(serv_http::field::etag, etag);
+			return reply;
+		}
+		const uint64_t start = serv_range_start(std::string(req[serv_http::field::range]), size);
+		reply.m_head = serv_http::response<serv_http::empty_body>(start != size ? serv_http::status::partial_content : serv_http::status::ok, req.version());
+		reply.m_head.set(serv_http::field::server, BOOST_BEAST_VERSION_STRING);
+		reply.m_head.set(serv_http::field::content_type, "application/octet-stream");
+		if (get) {
+			reply.m_head.set(serv_http::field::etag, etag);
+			reply.m_head.set(serv_http::field::cache_control, "public, max-age=31536000, immutable");
+			reply.m_head.set(serv_http::field::accept_ranges, "bytes");
+		}
+		if (start != size)
+			reply.m_head.set(serv_http::field::content_range, "bytes " + std::to_string(start) + "-" + std::to_string(size - 1) + "/" + std::to_string(size));
+		const uint64_t offset = start != size ? start : 0;
+		/* the length of the file part - not through prepare_payload, the empty_body would make it zero */
+		reply.m_head.content_length(size - offset);
+		reply.m_head.keep_alive(req.keep_alive());
+		reply.m_offset = offset;
+		reply.m_len = req.method() == serv_http::verb::head ? 0 : size - offset;
+		if (data) {
+			reply.m_cached = serv_http::response<serv_http::span_body<const char> >(std::move(reply.m_head.base()));
+			reply.m_cached.body() = serv_http::span_body<const char>::value_type(data->data() + offset, (size_t) reply.m_len);
+			reply.m_data = data;
+		}
+		else
+			reply.m_file = path;
+		return reply;
+	}
+
+	if (serv_manifestpath_parse(target, &hex)) {
+		const boost::filesystem::path path = gitdir / "manifest" / hex;
+		boost::system::error_code ec;
+		const uint64_t size = boost::filesystem::file_size(path, ec);
+		if (ec) {
+			small(serv_http::status::not_found, "");
+			return reply;
+		}
+		reply.m_head = serv_http::response<serv_http::empty_body>(serv_http::status::ok, req.version());
+		reply.m_head.set(serv_http::field::server, BOOST_BEAST_VERSION_STRING);
+		reply.m_head.set(serv_http::field::content_type, "application/octet-stream");
+		reply.m_head.content_length(size);
+		reply.m_head.keep_alive(req.keep_alive());
+		reply.m_file = path;
+		reply.m_len = req.method() == serv_http::verb::head ? 0 : size;
+		return reply;
+	}
+
+	if (serv_refpath_parse(target, &name)) {
+		try {
+			small(serv_http::status::ok, cruft_file_read(gitdir / "refs" / "heads" / name));
+		}
+		catch (std::exception &) {
+			small(serv_http::status::not_found, "");
+		}
+		return reply;
+	}
+
+	if (target == "/stats/cache" && req.method() != serv_http::verb::post) {
+		small(serv_http::status::ok, cache ? cache->stats() : "");
+		return reply;
+	}
+
+	small(serv_http::status::not_found, "");
+	return reply;
+}
+
+/* one connection - requests answered in order as they arrive (pipelined ones wait in m_buffer), kept alive as the client asks
+     cached objects are written from the cache's copy, other file bodies go out with sendfile on linux (socket switched to non-blocking, waits for writability on EAGAIN)
+       elsewhere the range is read into the body
+     a connection idle (no complete request) for idle is closed
+   handlers run serialized on m_strand, the session lives as long as a handler holds it */
+class ServSession : public std::enable_shared_from_this<ServSession>
+{
+public:
+	inline ServSession(serv_tcp::socket socket, const boost::filesystem::path &gitdir, const sp<ServCache> &cache, std::chrono::milliseconds idle) :
+		m_socket(std::move(socket)),
+		m_strand(m_socket.get_executor()),
+		m_timer(m_socket.get_executor()),
+		m_gitdir(gitdir),
+		m_cache(cache),
+		m_idle(idle),
+		m_buffer(),
+		m_req(),
+		m_reply(),
+		m_fd(-1),
+		m_sent(0),
+		m_gen(0)
+	{}
+
+	inline ~ServSession()
+	{
+		_file_close();
+	}
+
+	inline void start()
+	{
+		boost::asio::post(m_strand, [self = shared_from_this()]() { self->_read(); });
+	}
+
+	inline void _read()
+	{
+		m_req = {};
+		const uint64_t gen = ++m_gen;
+		m_timer.expires_after(m_idle);
+		m_timer.async_wait(boost::asio::bind_executor(m_strand, [self = shared_from_this(), gen](const boost::system::error_code &ec) {
+			/* an expiry already queued when the read completed is stale */
+			if (!ec && self->m_gen == gen)
+				self->_close();
+		}));
+		serv_http::async_read(m_socket, m_buffer, m_req, boost::asio::bind_executor(m_strand, [self = shared_from_this()](const boost::system::error_code &ec, size_t) {
+			self->m_gen++;
+			self->m_timer.cancel();
+			if (ec)
+				return self->_close();
+			self->_write();
+		}));
+	}
+
+	inline void _write()
+	{
+		m_reply = serv_route(m_gitdir, m_cache.get(), m_req);
+		if (m_reply.m_data) {
+			serv_http::async_write(m_socket, m_reply.m_cached, boost::asio::bind_executor(m_strand, [self = shared_from_this()](const boost::system::error_code &ec, size_t) {
+				if (ec)
+					return self->_close();
+				self->_done();
+			}));
+			return;
+		}
+		if (m_reply.m_file.empty())
+			return _write_reply();
+		try {
+			_file_open();
+		}
+		catch (std::exception &) {
+			/* gone between route and open */
+			m_reply.m_file.clear();
+			m_reply.m_res = serv_http::response<serv_http::string_body>(serv_http::status::not_found, m_req.version());
+			m_reply.m_res.keep_alive(m_req.keep_alive());
+			m_reply.m_res.prepare_payload();
+			return _write_reply();
+		}
+		serv_http::async_write(m_socket, m_reply.m_head, boost::asio::bind_executor(m_strand, [self = shared_from_this()](const boost::system::error_code &ec, size_t) {
+			if (ec)
+				return self->_close();
+			self->m_sent = 0;
+			self->_send_file();
+		}));
+	}
+
+	inline void _write_reply()
+	{
+		serv_http::async_write(m_socket, m_reply.m_res, boost::asio::bind_executor(m_strand, [self = shared_from_this()](const boost::system::error_code &ec, size_t) {
+			if (ec)
+				return self->_close();
+			self->_done();
+		}));
+	}
+
+#ifdef __linux__
+	inline void _file_open()
+	{
+		m_fd = ::open(m_reply.m_file.c_str(), O_RDONLY | O_CLOEXEC);
+		if (m_fd < 0)
+			throw std::runtime_error("file open");
+	}
+
+	inline void _file_close()
+	{
+		if (m_fd >= 0)
+			::close(m_fd);
+		m_fd = -1;
+	}
+
+	/* zero-copy - the kernel moves the file pages to the socket */
+	inline void _send_file()
+	{
+		m_socket.native_non_blocking(true);
+		while (m_sent < m_reply.m_len) {
+			off_t off = (off_t) (m_reply.m_offset + m_sent);
+			const ssize_t n = ::sendfile(m_socket.native_handle(), m_fd, &off, (size_t) std::min<uint64_t>(m_reply.m_len - m_sent, 1 << 30));
+			if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				m_socket.async_wait(serv_tcp::socket::wait_write, boost::asio::bind_executor(m_strand, [self = shared_from_this()](const boost::system::error_code &ec) {
+					if (ec)
+						return self->_close();
+					self->_send_file();
+				}));
+				return;
+			}
+			if (n < 0 && errno == EINTR)
+				continue;
+			if (n <= 0)
+				return _close();
+			m_sent += (uint64_t) n;
+		}
+		_file_close();
+		_done();
+	}
+#else
+	inline void _file_open()
+	{
+		m_fd = 0;
+	}
+
+	inline void _file_close()
+	{
+		m_fd = -1;
+	}
+
+	inline void _send_file()
+	{
+		std::string body;
+		if (m_reply.m_len) {
+			std::ifstream ff(m_reply.m_file.string().c_str(), std::ios::in | std::ios::binary);
+			body.resize((size_t) m_reply.m_len);
+			ff.seekg((std::streamoff) m_reply.m_offset);
+			if (!ff.read(&body[0], body.size()))
+				return _close();
+		}
+		m_file_body = sp<std::string>(new std::string(std::move(body)));
+		boost::asio::async_write(m_socket, boost::asio::buffer(*m_file_body), boost::asio::bind_executor(m_strand, [self = shared_from_this()](const boost::system::error_code &ec, size_t) {
+			if (ec)
+				return self->_close();
+			self->_file_close();
+			self->_done();
+		}));
+	}
+
+	sp<std::string> m_file_body;
+#endif
+
+	inline void _done()
+	{
+		if (!m_reply.keep_alive())
+			return _close();
+		_read();
+	}
+
+	inline void _close()
+	{
+		boost::system::error_code ec;
+		_file_close();
+		m_timer.cancel();
+		m_socket.shutdown(serv_tcp::socket::shutdown_both, ec);
+		m_socket.close(ec);
+	}
+
+	serv_tcp::socket m_socket;
+	boost::asio::strand<serv_tcp::socket::executor_type> m_strand;
+	boost::asio::steady_timer m_timer;
+	boost::filesystem::path m_gitdir;
+	sp<ServCache> m_cache;
+	std::chrono::milliseconds m_idle;
+	boost::beast::flat_buffer m_buffer;
+	serv_http::request<serv_http::string_body> m_req;
+	ServReply m_reply;
+	int m_fd;
+	uint64_t m_sent;
+	uint64_t m_gen;
+};
+
+/* accepts on host:port and serves the repository at gitdir (the .git directory) from nthreads threads sharing one io_context
+   cache_bytes of objects are kept in memory (zero - none) */
+class ServServer
+{
+public:
+	inline ServServer(const std::string &host, const std::string &port, const boost::filesystem::path &gitdir, size_t nthreads, size_t cache_bytes = 0, std::chrono::milliseconds idle = std::chrono::milliseconds(30000)) :
+		m_ioc(),
+		m_acceptor(m_ioc),
+		m_gitdir(gitdir),
+		m_cache(cache_bytes ? new ServCache(cache_bytes) : nullptr),
+		m_nthreads(std::max<size_t>(nthreads, 1)),
+		m_idle(idle),
+		m_thrs()
+	{
+		if (!boost::filesystem::is_directory(m_gitdir / "objects"))
+			throw std::runtime_error("gitdir");
+		const serv_tcp::endpoint ep = *serv_tcp::resolver(m_ioc).resolve(host, port).begin();
+		m_acceptor.open(ep.protocol());
+		m_acceptor.set_option(boost::asio::socket_base::reuse_address(true));
+		m_acceptor.bind(ep);
+		m_acceptor.listen(boost::asio::socket_base::max_listen_connections);
+	}
+
+	inline void _accept()
+	{
+		m_acceptor.async_accept([this](const boost::system::error_code &ec, serv_tcp::socket socket) {
+			if (!ec) {
+				socket.set_option(serv_tcp::no_delay(true));
+				std::make_shared<ServSession>(std::move(socket), m_gitdir, m_cache, m_idle)->start();
+			}
+			_accept();
+		});
+	}
+
+	inline void run()
+	{
+		_accept();
+		for (size_t i = 0; i < m_nthreads; i++)
+			m_thrs.push_back(std::thread([this]() { m_ioc.run(); }));
+		for (auto &t : m_thrs)
+			t.join();
+	}
+
+	inline void stop() { m_ioc.stop(); }
+
+	boost::asio::io_context m_ioc;
+	serv_tcp::acceptor m_acceptor;
+	boost::filesystem::path m_gitdir;
+	sp<ServCache> m_cache;
+	size_t m_nthreads;
+	std::chrono::milliseconds m_idle;
+	std::vector<std::thread> m_thrs;
+};
+
+}
+
+#endif /* _PSSERV_HPP_ */
@@ -1,10 +1,13 @@
 #ifndef _PSSFML_HPP_
 #define _PSSFML_HPP_
 
+#include <algorithm>
 #include <cassert>
 #include <chrono>
 #include <cstdint>
+#include <iomanip>
 #include <map>
+#include <sstream>
 #include <string>
 
 #include <SFML/Window.hpp>
@@ -56,7 +59,9 @@ public:
 		m_start(std::chrono::steady_clock::now()),
 		m_win(sf::VideoMode(800, 600), "perder.si"),
 		m_tex(),
-		m_thr(thr)
+		m_thr(thr),
+		m_rate(),
+		m_title()
 	{
 		m_win.setFramerateLimit(60);
 	}
@@ -73,14 +78,49 @@ public:
 				m_win.close();
 			m_win.clear(sf::Color(255, 255, 0));
 			m_tex.draw(m_win, "g_ps_data_test00", { 0, 0 }, { 256, 256 });
+			drawProgress();
 			m_win.display();
 		}
 	}
 
+	void drawProgress()
+	{
+		/* counters are atomics - no lock shared with the download threads */
+		const pstimept_t now = std::chrono::steady_clock::now();
+		const ConEst est = m_thr->m_client->m_prog->doEstimate();
+		m_rate.sample(now, est);
+
+		sf::RectangleShape bg(sf::Vector2f(760, 24));
+		bg.setPosition(20, 556);
+		bg.setFillColor(sf::Color(64, 64, 64));
+		m_win.draw(bg);
+		sf::RectangleShape fg(sf::Vector2f(760 * std::min(est.ratio(), 1.0f), 24));
+		fg.setPosition(20, 556);
+		fg.setFillColor(sf::Color(0, 160, 0));
+		m_win.draw(fg);
+
+		if (now - m_title < std::chrono::seconds(1))
+			return;
+		m_title = now;
+		const double eta = m_rate.eta();
+		std::stringstream ss;
+		ss << "perder.si - " << est.m_objects_written << "/" << est.m_objects_total << " objects";
+		if (est.m_objects_listed)
+			ss << " (" << est.m_objects_listed - est.m_objects_missing << "/" << est.m_objects_listed << " present)";
+		ss << " - " << std::fixed << std::setprecision(1) << (m_rate.bytesPerSec() / (1024 * 1024)) << " MiB/s";
+		if (eta >= 0.0)
+			ss << " - " << (uint64_t) eta << "s left";
+		if (est.m_retries)
+			ss << " - " << est.m_retries << " retries";
+		m_win.setTitle(ss.str());
+	}
+
 	pstimept_t m_start;
 	sf::RenderWindow m_win;
 	SfTex m_tex;
 	sp<Thr> m_thr;
+	ConRate m_rate;
+	pstimept_t m_title;
 };
 
 }
@@ -89,29 +89,102 @@ public:
 
 	virtual void run() override
 	{
-		unique_ptr_gitrepository repo(git_repository_ensure(m_config.get<std::string>("REPO_DIR")));
+		UpdaterSession sess(m_config.get<std::string>("REPO_DIR"));
 
 		const boost::filesystem::path chkoutdir = cruft_config_get_path(m_config, "REPO_CHK_DIR");
 		const boost::filesystem::path stage2path = chkoutdir / m_config.get<std::string>("UPDATER_STAGE2_EXE_RELATIVE");
 		const std::string updatr = m_config.get<std::string>("UPDATER_EXE_RELATIVE");
 
-		const shahex_t head = updater_head_get(m_client.get(), "master");
-		const shahex_t tree = updater_commit_tree_get(m_client.get(), head);
+		const oid_t head = updater_head_get(m_client.get(), "master");
+		const oid_t tree = updater_commit_tree_get(m_client.get(), head);
 
-		std::cout << "repodir: " << git_repository_path(repo.get()) << std::endl;
+		std::cout << "repodir: " << sess.m_repopath.string() << std::endl;
 		std::cout << "chkodir: " << chkoutdir.string() << std::endl;
 		std::cout << "stage2p: " << stage2path.string() << std::endl;
 		std::cout << "updatr: " << updatr << std::endl;
-		std::cout << "head: " << head << std::endl;
-		std::cout << "tree: " << tree << std::endl;
+		std::cout << "head: " << head.hex() << std::endl;
+		std::cout << "tree: " << tree.hex() << std::endl;
+
+		const size_t nconn = m_config.get<size_t>("UPDATER_FETCH_CONNECTIONS", 4);
+		const size_t batch = m_config.get<size_t>("UPDATER_PIPELINE_WINDOW", 1);
+		const std::vector<oid_t> haves = updater_installed_haves(&sess);
+
+		const bool pack = m_config.get<int>("UPDATER_PACK", 0);
+		const ConRetry retry = con_retry_from_config(m_config);
+		/* every connection of every pool runs on these - no thread per connection */
+		const sp<UpdaterIo> io(new UpdaterIo(m_config.get<size_t>("UPDATER_IO_THREADS", 1)));
+		/* paths as in the tree - '/' separated */
+		const std::vector<std::string> critical = { boost::replace_all_copy(updatr, "\\", "/"), boost::replace_all_copy(m_config.get<std::string>("UPDATER_STAGE2_EXE_RELATIVE"), "\\", "/") };
+		const sp<UpdaterSchedPolicy> policy = updater_sched_policy_create(
+			m_config.get<std::string>("UPDATER_SCHED", "critical"),
+			critical,
+			m_config.get<uint64_t>("UPDATER_SCHED_LARGE", 1024 * 1024));
+		/* blobs missing from the checkout fetched by the checkout itself, straight into place (see updater_checkout)
+		   a delta fetch cannot tell blobs from trees - its blobs still go through the objects directory */
+		const bool fused = !pack && m_config.get<int>("UPDATER_CHECKOUT_FUSED", 0);
+
+		bool delta = false;
+		std::vector<oid_t> objs;
+		if (!pack && haves.size()) {
+			try {
+				objs = updater_delta_get(m_client.get(), head, haves);
+				delta = true;
+			}
+			catch (ConExc &) {
+				/* installed commit unknown to the server (history rewritten?) - full walk */
+			}
+		}
+
+		up<UpdaterManifest> manifest;
+		if (!pack && !delta) {
+			try {
+				manifest = updater_manifest_get(m_client.get(), &sess, head, tree);
+			}
+			catch (ConExc &) {
+				/* published without a manifest (or an older server) - tree walk */
+			}
+		}
 
-		const std::vector<shahex_t> trees = updater_trees_get_writing_recursive(m_client.get(), repo.get(), tree);
-		const std::vector<shahex_t> blobs = updater_blobs_list(repo.get(), trees);
-		m_client->m_prog.setObjectsList(blobs);
-		updater_blobs_get_writing(m_client.get(), repo.get(), blobs);
-		git_checkout_obj(repo.get(), head, chkoutdir.string());
+		if (pack) {
+			updater_pack_get_writing(m_client.get(), &sess, head, haves);
+		}
+		else if (delta) {
+			UpdaterFetchPool pool(m_client, nconn, batch, sess.m_repopath, policy, retry, io);
+			const std::vector<oid_t> mis = sess.missing(objs);
+			m_client->m_prog->setObjectsList(objs, mis);
+			updater_push_sized(&pool, m_client.get(), mis);
+			pool.join();
+		}
+		else if (manifest) {
+			UpdaterFetchPool pool(m_client, nconn, batch, sess.m_repopath, policy, retry, io);
+			updater_push_sized(&pool, m_client.get(), { head });
+			std::vector<oid_t> mis;
+			const std::vector<oid_t> blobs = updater_manifest_push(&pool, &sess, *manifest, &mis, !fused);
+			m_client->m_prog->setObjectsList(blobs, mis);
+			pool.join();
+		}
+		else {
+			UpdaterFetchPool blobpool(m_client, nconn, batch, sess.m_repopath, policy, retry, io);
+			/* the commit too - it becomes the have of the next update */
+			updater_push_sized(&blobpool, m_client.get(), { head });
+			std::vector<oid_t> mis;
+			const std::vector<oid_t> blobs = updater_trees_get_writing_bfs(m_client, &sess, tree, nconn, batch, &blobpool, &mis, !fused);
+			m_client->m_prog->setObjectsList(blobs, mis);
+			blobpool.join();
+		}
+		const bool diff = m_config.get<std::string>("UPDATER_CHECKOUT", "diff") == "diff";
+		const size_t nthreads = m_config.get<size_t>("UPDATER_CHECKOUT_THREADS", 1);
+		if (fused) {
+			/* the updater blob stays in the odb - self update reads it from there (see updater_replace_cond) */
+			UpdaterFetchPool fusepool(m_client, nconn, batch, sess.m_repopath, policy, retry, io);
+			updater_checkout(&sess, tree, chkoutdir, diff, nthreads, &fusepool, critical);
+		}
+		else {
+			updater_checkout(&sess, tree, chkoutdir, diff, nthreads);
+		}
+		updater_installed_set(&sess, head);
 
-		updater_replace_cond(m_config.get<int>("ARG_SKIPSELFUPDATE"), repo.get(), head, updatr, cruft_current_executable_filename(), stage2path);
+		updater_replace_cond(m_config.get<int>("ARG_SKIPSELFUPDATE"), sess.m_repo.get(), tree, updatr, cruft_current_executable_filename(), stage2path);
 	}
 
 	pt_t m_config;
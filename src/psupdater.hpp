@@ -2,7 +2,18 @@
 #define _PSUPDATER_HPP_
 
 #include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include <tuple>
 #include <utility>
@@ -13,109 +24,902 @@
 #include <pscon.hpp>
 #include <pscruft.hpp>
 #include <psgit.hpp>
+#include <psmanifest.hpp>
 #include <psmisc.hpp>
+#include <pssched.hpp>
 
 namespace ps
 {
 
+/* libgit2 handles held for the duration of one update (Thr::run)
+     every stage shares the one odb - its backends and pack index list are set up once
+     instead of per object through odb_from_repo */
+class UpdaterSession
+{
+public:
+	inline UpdaterSession(const std::string &repodir) :
+		m_repo(git_repository_ensure(repodir)),
+		m_odb(odb_from_repo(m_repo.get())),
+		m_repopath(git_repository_path(m_repo.get()))
+	{}
+
+	inline bool exists(const oid_t &obj) { return git_odb_exists(m_odb.get(), git_oidt2bin(obj)); }
+
+	/* the subset of objs not present (see git_odb_missing) */
+	inline std::vector<oid_t> missing(const std::vector<oid_t> &objs) { return git_odb_missing(m_odb.get(), m_repopath / "objects", objs); }
+
+	unique_ptr_gitrepository m_repo;
+	unique_ptr_gitodb m_odb;
+	boost::filesystem::path m_repopath;
+};
+
+inline std::string
+updater_object_path(const oid_t &obj)
+{
+	const std::string hex = obj.hex();
+	return "/objects/" + hex.substr(0, 2) + "/" + hex.substr(2);
+}
+
+/* loose object file under repopath (the .git directory) */
+inline boost::filesystem::path
+updater_object_file(const boost::filesystem::path &repopath, const oid_t &obj)
+{
+	const std::string hex = obj.hex();
+	return repopath / "objects" / hex.substr(0, 2) / hex.substr(2);
+}
+
+inline std::string
+updater_object_get(Con *client, const oid_t &obj)
+{
+	return client->reqPost(updater_object_path(obj), "").body();
+}
+
+/* sink of one object of a fetch - m_done once the object is verified and in place */
+class UpdaterSink : public ConSink
+{
+public:
+	inline UpdaterSink() :
+		m_done(false)
+	{}
+
+	bool m_done;
+};
+
+/* loose object streamed off the connection into a staging file (.git/ps_partial/<hex>), verified as it passes through
+   only renamed into the objects directory once the whole object hashes to obj (on done)
+   a connection dropping mid-object leaves the staging file - the next sink for obj replays it through the verifier
+     and asks only for the rest (see ConSink::offset), a staging file that does not verify is thrown away */
+class UpdaterObjectSink : public UpdaterSink
+{
+public:
+	inline UpdaterObjectSink(ConProgress *prog, const boost::filesystem::path &repopath, const oid_t &obj) :
+		UpdaterSink(),
+		m_prog(prog),
+		m_repopath(repopath),
+		m_obj(obj),
+		m_ver(new GitLooseVerifier()),
+		m_file(".git", repopath / "ps_partial" / obj.hex())
+	{
+		if (m_file.m_size) {
+			try {
+				const size_t CHUNK = 65536;
+				std::vector<char> chunk(CHUNK);
+				std::ifstream ff(m_file.m_stagepath.string().c_str(), std::ios::in | std::ios::binary);
+				uint64_t replayed = 0;
+				while (ff.read(chunk.data(), chunk.size()) || ff.gcount()) {
+					m_ver->update(chunk.data(), (size_t) ff.gcount());
+					replayed += (uint64_t) ff.gcount();
+				}
+				if (!ff.eof() || replayed != m_file.m_size)
+					throw std::runtime_error("partial read");
+			}
+			catch (std::exception &) {
+				m_file.discard();
+				m_ver.reset(new GitLooseVerifier());
+			}
+		}
+		m_file.open();
+	}
+
+	inline virtual void write(const char *data, size_t len) override
+	{
+		m_ver->update(data, len);
+		m_file.write(data, len);
+	}
+
+	inline virtual uint64_t offset() override { return m_file.m_size; }
+
+	inline virtual void restart() override
+	{
+		m_file.truncate();
+		m_ver.reset(new GitLooseVerifier());
+	}
+
+	inline virtual void done() override
+	{
+		m_prog->onObjectReceived();
+		try {
+			git_oideq(m_obj, m_ver->finish());
+		}
+		catch (std::exception &) {
+			m_file.discard();
+			throw;
+		}
+		m_prog->onObjectVerified();
+		m_file.commit(".git", updater_object_file(m_repopath, m_obj));
+		m_prog->onObjectWritten(m_file.m_size);
+		m_done = true;
+	}
+
+	ConProgress *m_prog;
+	boost::filesystem::path m_repopath;
+	oid_t m_obj;
+	up<GitLooseVerifier> m_ver;
+	CruftFileWriteResumable m_file;
+};
+
+/* blob streamed off the connection straight into the checkout - fused download and checkout, no read back from the odb
+   inflated as it is verified, the content goes to a staging file for each of items (blob at several paths - one for each)
+     staged as (hex).(index) in the staging directory of the checkout (see git_checkout_stage_dir)
+     only renamed over the items once the whole object hashes to obj (on done), the directories already exist (see git_checkout_parallel_prepare)
+   the bytes as received are the loose object - staged as with UpdaterObjectSink and committed into the objects directory on done
+     the installed commit is reported as a have later (see updater_installed_haves) - the server then leaves its blobs out
+   nothing to resume from - the checkout staging files would need replaying too, a dropped connection starts the blob over (see ConSink::offset) */
+class UpdaterCheckoutSink : public UpdaterSink
+{
+public:
+	inline UpdaterCheckoutSink(ConProgress *prog, const boost::filesystem::path &repopath, const boost::filesystem::path &chkoutdir, const oid_t &obj, const std::vector<GitCheckoutItem> &items) :
+		UpdaterSink(),
+		m_prog(prog),
+		m_repopath(repopath),
+		m_chkoutdir(chkoutdir),
+		m_stagedir(git_checkout_stage_dir(chkoutdir)),
+		m_obj(obj),
+		m_items(items),
+		m_ver(),
+		m_ffs(),
+		m_file(".git", repopath / "ps_partial" / obj.hex())
+	{
+		for (size_t i = 0; i < m_items.size(); i++)
+			m_ffs.push_back(up<std::ofstream>(new std::ofstream()));
+		m_file.open();
+		restart();
+	}
+
+	inline ~UpdaterCheckoutSink()
+	{
+		if (!m_done)
+			_discard();
+	}
+
+	inline virtual void write(const char *data, size_t len) override
+	{
+		m_ver->update(data, len);
+		m_file.write(data, len);
+	}
+
+	inline virtual void restart() override
+	{
+		for (size_t i = 0; i < m_items.size(); i++) {
+			m_ffs[i]->close();
+			m_ffs[i]->clear();
+			m_ffs[i]->open(_stagepath(i).string().c_str(), std::ios::out | std::ios::trunc | std::ios::binary);
+			if (!m_ffs[i]->good())
+				throw std::runtime_error("checkout write");
+		}
+		m_file.truncate();
+		m_ver.reset(new GitLooseVerifier());
+		m_ver->m_content = [this](const char *data, size_t len) {
+			for (const auto &ff : m_ffs)
+				ff->write(data, (std::streamsize) len);
+		};
+	}
+
+	inline virtual void done() override
+	{
+		m_prog->onObjectReceived();
+		try {
+			git_oideq(m_obj, m_ver->finish());
+		}
+		catch (std::exception &) {
+			_discard();
+			throw;
+		}
+		m_prog->onObjectVerified();
+		for (size_t i = 0; i < m_items.size(); i++) {
+			const boost::filesystem::path finalpath = m_chkoutdir / m_items[i].m_path;
+			m_ffs[i]->flush();
+			m_ffs[i]->close();
+			if (!m_ffs[i]->good())
+				throw std::runtime_error("checkout write");
+			if (m_items[i].m_mode == GIT_FILEMODE_BLOB_EXECUTABLE)
+				boost::filesystem::permissions(_stagepath(i), boost::filesystem::add_perms | boost::filesystem::owner_exe | boost::filesystem::group_exe | boost::filesystem::others_exe);
+			/* a directory where the file goes (full checkout over another tree) */
+			if (boost::filesystem::is_directory(finalpath))
+				boost::filesystem::remove_all(finalpath);
+			cruft_rename_file_file(_stagepath(i).string(), finalpath.string());
+		}
+		m_file.commit(".git", updater_object_file(m_repopath, m_obj));
+		/* as received (loose, compressed) - the unit of the expected sizes (see updater_sizes_get) */
+		m_prog->onObjectWritten(m_file.m_size);
+		m_done = true;
+	}
+
+	inline boost::filesystem::path _stagepath(size_t i) { return m_stagedir / (m_obj.hex() + "." + std::to_string(i)); }
+
+	inline void _discard()
+	{
+		boost::system::error_code ec;
+		for (size_t i = 0; i < m_items.size(); i++) {
+			m_ffs[i]->close();
+			boost::filesystem::remove(_stagepath(i), ec);
+		}
+		m_file.discard();
+	}
+
+	ConProgress *m_prog;
+	boost::filesystem::path m_repopath;
+	boost::filesystem::path m_chkoutdir;
+	boost::filesystem::path m_stagedir;
+	oid_t m_obj;
+	std::vector<GitCheckoutItem> m_items;
+	up<GitLooseVerifier> m_ver;
+	std::vector<up<std::ofstream> > m_ffs;
+	CruftFileWriteResumable m_file;
+};
+
 inline std::string
-updater_object_get(Con *client, const shahex_t &obj)
+updater_haves_data(const std::vector<oid_t> &haves)
+{
+	std::string data;
+	for (const auto &have : haves)
+		data += have.hex() + "\n";
+	return data;
+}
+
+class UpdaterPackSink : public ConSink
+{
+public:
+	inline UpdaterPackSink(ConProgress *prog, UpdaterSession *sess) :
+		m_prog(prog),
+		m_ing(sess->m_repo.get(), sess->m_odb.get()),
+		m_len(0)
+	{}
+
+	inline virtual void write(const char *data, size_t len) override
+	{
+		m_ing.append(data, len);
+		m_len += len;
+		m_prog->onPack(m_ing.m_stats.total_objects, m_ing.m_stats.received_objects, m_ing.m_stats.indexed_objects);
+	}
+
+	inline void commit()
+	{
+		m_ing.commit();
+		m_prog->onPack(m_ing.m_stats.total_objects, m_ing.m_stats.received_objects, m_ing.m_stats.indexed_objects);
+		m_prog->onPackWritten(m_ing.m_stats.indexed_objects, m_len);
+	}
+
+	ConProgress *m_prog;
+	GitPackIngester m_ing;
+	size_t m_len;
+};
+
+/* one packfile of everything reachable from want but not from haves - streamed into the indexer as it arrives */
+inline void
+updater_pack_get_writing(Con *client, UpdaterSession *sess, const oid_t &want, const std::vector<oid_t> &haves)
+{
+	UpdaterPackSink sink(client->m_prog.get(), sess);
+	client->reqPostSink("/pack/" + want.hex(), updater_haves_data(haves), &sink);
+	sink.commit();
+}
+
+/* objects reachable from want but not from haves (commit, changed trees and blobs) */
+inline std::vector<oid_t>
+updater_delta_get(Con *client, const oid_t &want, const std::vector<oid_t> &haves)
+{
+	std::vector<oid_t> objs;
+	std::stringstream ss(client->reqPost("/delta/" + want.hex(), updater_haves_data(haves)).body());
+	for (std::string obj; ss >> obj;)
+		objs.push_back(oid_t::fromhex(obj));
+	return objs;
+}
+
+/* expected download size of each of objs (loose, compressed) - zeros if the server cannot tell */
+inline std::vector<uint64_t>
+updater_sizes_get(Con *client, const std::vector<oid_t> &objs)
+{
+	std::vector<uint64_t> sizes(objs.size(), 0);
+	if (objs.empty())
+		return sizes;
+	std::string body;
+	try {
+		body = client->reqPost("/sizes/", updater_haves_data(objs)).body();
+	}
+	catch (ConExc &) {
+		/* older server (or ConFs) - progress falls back to object counts */
+		return sizes;
+	}
+	std::stringstream ss(body);
+	std::string obj;
+	uint64_t size = 0;
+	for (size_t i = 0; i < objs.size(); i++) {
+		if (!(ss >> obj >> size) || oid_t::fromhex(obj) != objs[i])
+			throw ConExc();
+		sizes[i] = size;
+	}
+	return sizes;
+}
+
+/* the manifest of commit (tree its root) - kept as PS_MANIFEST and mapped from there
+   ConExc if the server has none (published before manifests, or ConFs without one) or it does not describe commit */
+inline up<UpdaterManifest>
+updater_manifest_get(Con *client, UpdaterSession *sess, const oid_t &commit, const oid_t &tree)
+{
+	const boost::filesystem::path path = sess->m_repopath / "PS_MANIFEST";
+	cruft_file_write_moving(".git", path, client->reqPost("/manifest/" + commit.hex(), "").body());
+	up<UpdaterManifest> manifest;
+	try {
+		manifest.reset(new UpdaterManifest(path));
+	}
+	catch (std::exception &) {
+		throw ConExc();
+	}
+	UpdaterManifestEntry root;
+	if (manifest->m_commit != commit || !manifest->find("", &root) || root.m_oid != tree)
+		throw ConExc();
+	return manifest;
+}
+
+/* the tree last checked out into the checkout directory, ref-formatted - the baseline of the next diff checkout
+   removed while a checkout runs, an interrupted one is redone in full */
+inline boost::filesystem::path
+updater_checkout_tree_path(UpdaterSession *sess)
+{
+	return sess->m_repopath / "PS_CHECKOUT_TREE";
+}
+
+/* the commit of the last successful update - kept alongside HEAD as a ref-formatted file
+   only reported as a have while its objects are still present */
+inline boost::filesystem::path
+updater_installed_path(UpdaterSession *sess)
 {
-	return client->reqPost("/objects/" + obj.substr(0, 2) + "/" + obj.substr(2), "").body();
+	return sess->m_repopath / "PS_INSTALLED_HEAD";
 }
 
-inline shahex_t
+inline std::vector<oid_t>
+updater_installed_haves(UpdaterSession *sess)
+{
+	if (!boost::filesystem::exists(updater_installed_path(sess)))
+		return {};
+	const oid_t installed = oid_t::fromhex(git_refcontent2hex(cruft_file_read(updater_installed_path(sess))));
+	if (!sess->exists(installed))
+		return {};
+	return { installed };
+}
+
+inline void
+updater_installed_set(UpdaterSession *sess, const oid_t &head)
+{
+	cruft_file_write_moving(".git", updater_installed_path(sess), head.hex() + "\n");
+}
+
+inline oid_t
 updater_head_get(Con *client, const std::string &refname)
 {
-	return git_refcontent2hex(client->reqPost("/refs/heads/" + refname, "").body());
+	return oid_t::fromhex(git_refcontent2hex(client->reqPost("/refs/heads/" + refname, "").body()));
 }
 
-inline shahex_t
-updater_commit_tree_get(Con *client, const shahex_t &commit)
+inline oid_t
+updater_commit_tree_get(Con *client, const oid_t &commit)
 {
 	const std::string &incoming_comt = git_inflatebuf(updater_object_get(client, commit));
-	git_hexeq(commit, git_incoming_data_hex(incoming_comt));
+	git_oideq(commit, oid_t::fromhex(git_incoming_data_hex(incoming_comt)));
 	const GitObjectDataInfo odi(incoming_comt, git_tag_incoming_data_t());
 	if (odi.m_type != "commit")
 		throw ConExc();
-	return git_comtcontent_tree2hex(std::string(incoming_comt.data() + odi.m_data_offset, incoming_comt.size() - odi.m_data_offset));
+	return oid_t::fromhex(git_comtcontent_tree2hex(std::string(incoming_comt.data() + odi.m_data_offset, incoming_comt.size() - odi.m_data_offset)));
 }
 
-inline void
-updater_object_write_raw_ifnotexist(Con *client, git_repository *repo, const shahex_t &obj, const std::string &incoming_loose)
+/* io_context run by nthreads threads for the lifetime of the object
+   connections forked onto it (see Con::forkAsync) are driven by its handlers - any number of them on these few threads */
+class UpdaterIo
 {
-	git_hexeq(obj, git_incoming_data_hex(git_inflatebuf(incoming_loose)));
-	if (! git_odb_exists(odb_from_repo(repo).get(), git_hex2bin(obj)))
-		cruft_file_write_moving(".git", boost::filesystem::path(git_repository_path(repo)) / "objects" / obj.substr(0, 2) / obj.substr(2), incoming_loose);;
-}
+public:
+	inline UpdaterIo(size_t nthreads = 1) :
+		m_ioc(new boost::asio::io_context()),
+		m_work(boost::asio::make_work_guard(*m_ioc)),
+		m_thrs()
+	{
+		for (size_t i = 0; i < std::max<size_t>(nthreads, 1); i++)
+			m_thrs.push_back(std::thread([this]() { m_ioc->run(); }));
+	}
+
+	inline ~UpdaterIo()
+	{
+		m_work.reset();
+		for (auto &t : m_thrs)
+			if (t.joinable())
+				t.join();
+	}
 
-inline std::vector<shahex_t>
-updater_trees_get_writing_recursive(Con *client, git_repository *repo, const shahex_t &tree)
+	sp<boost::asio::io_context> m_ioc;
+	boost::asio::executor_work_guard<boost::asio::io_context::executor_type> m_work;
+	std::vector<std::thread> m_thrs;
+};
+
+/* drains a queue of objects over nconn connections (forked off client onto io - see Con::forkAsync)
+     objects are taken in the order of policy (see UpdaterSchedPolicy - first come first served if none)
+     each connection takes up to batch objects at a time (see Con::reqPostMultiAsync - pipelined on ConNet)
+     objects are streamed to disk and verified as they arrive (see UpdaterObjectSink)
+       blobs handed to fuse go straight into the checkout instead (see UpdaterCheckoutSink)
+     a connection failing mid-batch (or a server side error) is replaced as retry allows, after its backoff (see ConRetry)
+       objects not yet written are asked for again, partially received ones continue where they stopped
+     no thread per connection - every connection is a chain of handlers on io, the backoff a timer
+     only the io threads touch the connections - libgit2 is not used here
+   drain waits for everything pushed so far without closing the pool (m_inflight counts popped but unwritten objects)
+   the first failing object aborts the remaining work and is rethrown from join (or drain)
+     verified objects already written stay valid (content-addressed) but the caller never gets to checkout */
+class UpdaterFetchPool
 {
-	std::vector<shahex_t> out;
+public:
+	/* one connection - busy from taking a batch until it finds the queue empty (or the pool failed) */
+	class Slot
+	{
+	public:
+		inline Slot(boost::asio::io_context &ioc) :
+			m_con(),
+			m_objs(),
+			m_left(),
+			m_sinks(),
+			m_attempt(0),
+			m_timer(ioc),
+			m_busy(false)
+		{}
 
-	updater_object_write_raw_ifnotexist(client, repo, tree, updater_object_get(client, tree));
+		sp<Con> m_con;
+		std::vector<oid_t> m_objs;
+		std::vector<oid_t> m_left;
+		std::vector<up<UpdaterSink> > m_sinks;
+		size_t m_attempt;
+		boost::asio::steady_timer m_timer;
+		bool m_busy;
+	};
 
-	out.push_back(tree);
+	inline UpdaterFetchPool(const sp<Con> &client, size_t nconn, size_t batch, const boost::filesystem::path &repopath, const sp<UpdaterSchedPolicy> &policy = sp<UpdaterSchedPolicy>(), const ConRetry &retry = ConRetry(), const sp<UpdaterIo> &io = sp<UpdaterIo>()) :
+		m_io(io ? io : sp<UpdaterIo>(new UpdaterIo())),
+		m_mtx(),
+		m_cv_done(),
+		m_batch(std::max<size_t>(batch, 1)),
+		m_retry(retry),
+		m_repopath(repopath),
+		m_client(client),
+		m_prog(client->m_prog),
+		m_queue(policy ? policy : sp<UpdaterSchedPolicy>(new UpdaterSchedFifo())),
+		m_inflight(0),
+		m_busy(0),
+		m_kicks(0),
+		m_exc(),
+		m_slots(),
+		m_chkoutdir(),
+		m_fused()
+	{
+		for (size_t i = 0; i < std::max<size_t>(nconn, 1); i++)
+			m_slots.push_back(up<Slot>(new Slot(*m_io->m_ioc)));
+	}
 
-	unique_ptr_gittree t(tree_lookup(repo, git_hex2bin(tree)));
-	for (size_t i = 0; i < git_tree_entrycount(t.get()); ++i)
-		if (git_tree_entry_filemode(git_tree_entry_byindex(t.get(), i)) == GIT_FILEMODE_TREE)
-			for (const auto &elt : updater_trees_get_writing_recursive(client, repo, git_bin2hex(*git_tree_entry_id(git_tree_entry_byindex(t.get(), i)))))
-				out.push_back(elt);
-	return out;
-}
+	/* handlers refer to the pool - wait them out */
+	inline ~UpdaterFetchPool()
+	{
+		std::unique_lock<std::mutex> l(m_mtx);
+		m_queue.clear();
+		m_cv_done.wait(l, [this]() { return !m_busy && !m_kicks; });
+	}
 
+	inline void push(const UpdaterSchedItem &item)
+	{
+		{
+			std::lock_guard<std::mutex> l(m_mtx);
+			if (m_exc)
+				return;
+			m_queue.push(item);
+			m_kicks++;
+		}
+		m_prog->onQueued(1, item.m_size);
+		boost::asio::post(*m_io->m_ioc, [this]() { _kick(); });
+	}
+
+	/* blobs of fused, pushed after this, are written to their items under chkoutdir - and, as received, to the objects directory
+	   the directories of the items must exist (see git_checkout_parallel_prepare) */
+	inline void fuse(const boost::filesystem::path &chkoutdir, const std::unordered_map<oid_t, std::vector<GitCheckoutItem> > &fused)
+	{
+		std::lock_guard<std::mutex> l(m_mtx);
+		m_chkoutdir = chkoutdir;
+		m_fused = fused;
+	}
+
+	inline void drain()
+	{
+		std::unique_lock<std::mutex> l(m_mtx);
+		m_cv_done.wait(l, [this]() { return m_exc || (m_queue.empty() && !m_inflight); });
+		if (m_exc)
+			std::rethrow_exception(m_exc);
+	}
+
+	inline void join()
+	{
+		std::unique_lock<std::mutex> l(m_mtx);
+		m_cv_done.wait(l, [this]() { return (m_exc || (m_queue.empty() && !m_inflight)) && !m_busy && !m_kicks; });
+		if (m_exc)
+			std::rethrow_exception(m_exc);
+	}
+
+	/* puts idle connections to work */
+	inline void _kick()
+	{
+		for (const auto &slot : m_slots) {
+			{
+				std::lock_guard<std::mutex> l(m_mtx);
+				if (slot->m_busy || m_exc || m_queue.empty())
+					continue;
+				slot->m_busy = true;
+				m_busy++;
+			}
+			_next(slot.get());
+		}
+		std::lock_guard<std::mutex> l(m_mtx);
+		m_kicks--;
+		m_cv_done.notify_all();
+	}
+
+	inline void _idle(Slot *slot)
+	{
+		slot->m_busy = false;
+		m_busy--;
+		m_cv_done.notify_all();
+	}
+
+	inline void _next(Slot *slot)
+	{
+		{
+			std::lock_guard<std::mutex> l(m_mtx);
+			if (m_exc || m_queue.empty())
+				return _idle(slot);
+			slot->m_objs.clear();
+			while (m_queue.size() && slot->m_objs.size() < m_batch)
+				slot->m_objs.push_back(m_queue.pop().m_obj);
+			m_inflight += slot->m_objs.size();
+		}
+		slot->m_left = slot->m_objs;
+		slot->m_attempt = 1;
+		_fetch(slot);
+	}
+
+	inline void _fetch(Slot *slot)
+	{
+		std::vector<std::string> paths;
+		std::vector<ConSink *> sinkps;
+		try {
+			if (!slot->m_con)
+				slot->m_con = m_client->forkAsync(m_io->m_ioc);
+			slot->m_sinks.clear();
+			for (const auto &obj : slot->m_left) {
+				paths.push_back(updater_object_path(obj));
+				slot->m_sinks.push_back(_sink(obj));
+				sinkps.push_back(slot->m_sinks.back().get());
+			}
+		}
+		catch (std::exception &) {
+			return _fetched(slot, std::current_exception());
+		}
+		slot->m_con->reqPostMultiAsync(paths, sinkps, [this, slot](std::exception_ptr e) { _fetched(slot, e); });
+	}
+
+	inline up<UpdaterSink> _sink(const oid_t &obj)
+	{
+		std::lock_guard<std::mutex> l(m_mtx);
+		auto it = m_fused.find(obj);
+		if (it != m_fused.end())
+			return up<UpdaterSink>(new UpdaterCheckoutSink(m_prog.get(), m_repopath, m_chkoutdir, obj, it->second));
+		return up<UpdaterSink>(new UpdaterObjectSink(m_prog.get(), m_repopath, obj));
+	}
+
+	/* connection level failures (reset, cut short, timed out) and server side errors are retried */
+	inline bool _retryable(std::exception_ptr e, size_t attempt)
+	{
+		if (attempt >= m_retry.m_attempts)
+			return false;
+		try {
+			std::rethrow_exception(e);
+		}
+		catch (boost::system::system_error &) {
+			return true;
+		}
+		catch (ConExcStatus &s) {
+			return s.m_status >= 500;
+		}
+		catch (std::exception &) {
+			return false;
+		}
+	}
+
+	inline void _fetched(Slot *slot, std::exception_ptr e)
+	{
+		/* objects not yet in place - asked for again on retry */
+		std::vector<oid_t> left;
+		for (size_t i = 0; i < slot->m_left.size(); i++)
+			if (i >= slot->m_sinks.size() || !slot->m_sinks[i]->m_done)
+				left.push_back(slot->m_left[i]);
+		if (!e && left.size())
+			e = std::make_exception_ptr(ConExc());
+		slot->m_sinks.clear();
+		slot->m_left = std::move(left);
+		if (!e) {
+			{
+				std::lock_guard<std::mutex> l(m_mtx);
+				m_inflight -= slot->m_objs.size();
+				m_cv_done.notify_all();
+			}
+			return _next(slot);
+		}
+		if (!_retryable(e, slot->m_attempt)) {
+			std::lock_guard<std::mutex> l(m_mtx);
+			if (!m_exc)
+				m_exc = e;
+			m_queue.clear();
+			return _idle(slot);
+		}
+		m_prog->onRetry();
+		/* the connection is replaced off its own handler chain (see ConNet::_a_finish) */
+		slot->m_timer.expires_after(m_retry.delay(slot->m_attempt));
+		slot->m_timer.async_wait([this, slot](const boost::system::error_code &) {
+			{
+				std::lock_guard<std::mutex> l(m_mtx);
+				if (m_exc)
+					return _idle(slot);
+			}
+			slot->m_con.reset();
+			slot->m_attempt++;
+			_fetch(slot);
+		});
+	}
+
+	sp<UpdaterIo> m_io;
+	std::mutex m_mtx;
+	std::condition_variable m_cv_done;
+	size_t m_batch;
+	ConRetry m_retry;
+	boost::filesystem::path m_repopath;
+	sp<Con> m_client;
+	sp<ConProgress> m_prog;
+	UpdaterSchedQueue m_queue;
+	size_t m_inflight;
+	size_t m_busy;
+	size_t m_kicks;
+	std::exception_ptr m_exc;
+	std::vector<up<Slot> > m_slots;
+	boost::filesystem::path m_chkoutdir;
+	std::unordered_map<oid_t, std::vector<GitCheckoutItem> > m_fused;
+};
+
+/* objs (at paths, if known) with their sizes - for the pool policy and the progress estimate */
 inline void
-updater_blobs_get_writing(Con *client, git_repository *repo, const std::vector<shahex_t> &blobs)
+updater_push_sized(UpdaterFetchPool *pool, Con *client, const std::vector<oid_t> &objs, const std::vector<std::string> &paths = std::vector<std::string>())
+{
+	const std::vector<uint64_t> sizes = updater_sizes_get(client, objs);
+	for (size_t i = 0; i < objs.size(); i++)
+		pool->push(UpdaterSchedItem(objs[i], sizes[i], i < paths.size() ? paths[i] : std::string()));
+}
+
+/* every tree and blob of manifest into pool at once, with its path and size - no tree walk
+   returns every (unique) blob of the manifest, missing or not - the missing ones also go to mis
+   !withblobs - trees only, the blobs are left to a fused checkout (see updater_checkout) */
+inline std::vector<oid_t>
+updater_manifest_push(UpdaterFetchPool *pool, UpdaterSession *sess, const UpdaterManifest &manifest, std::vector<oid_t> *mis, bool withblobs = true)
 {
-	for (const auto &blob : blobs)
-		updater_object_write_raw_ifnotexist(client, repo, blob, updater_object_get(client, blob));
+	std::unordered_map<oid_t, UpdaterManifestEntry> entryof;
+	std::vector<oid_t> objs, blobs;
+	for (size_t i = 0; i < manifest.size(); i++) {
+		UpdaterManifestEntry e = manifest.entry(i);
+		if (entryof.count(e.m_oid))
+			continue;
+		objs.push_back(e.m_oid);
+		if (e.m_mode != GIT_FILEMODE_TREE)
+			blobs.push_back(e.m_oid);
+		entryof[e.m_oid] = std::move(e);
+	}
+	for (const auto &obj : sess->missing(objs)) {
+		const UpdaterManifestEntry &e = entryof[obj];
+		if (!withblobs && e.m_mode != GIT_FILEMODE_TREE)
+			continue;
+		pool->push(UpdaterSchedItem(obj, e.m_csize, e.m_path));
+		if (e.m_mode != GIT_FILEMODE_TREE)
+			mis->push_back(obj);
+	}
+	return blobs;
 }
 
-inline std::vector<shahex_t>
-updater_blobs_list(git_repository *repo, const std::vector<shahex_t> &trees)
+/* level-by-level tree discovery
+     the missing trees of a level are fetched concurrently over their own pool (on the io threads of blobpool), subtree OIDs seen before are skipped
+     the missing blobs of a level are handed to blobpool once the level is parsed - blob download overlaps the rest of the walk
+     blobs go with their paths, blobpool's policy may favour some (see UpdaterSchedCritical)
+   returns every (unique) blob reachable from tree, missing or not - the missing ones also go to mis
+   !withblobs - trees only, the blobs are left to a fused checkout (see updater_checkout) */
+inline std::vector<oid_t>
+updater_trees_get_writing_bfs(const sp<Con> &client, UpdaterSession *sess, const oid_t &tree, size_t nconn, size_t batch, UpdaterFetchPool *blobpool, std::vector<oid_t> *mis, bool withblobs = true)
 {
-	std::vector<shahex_t> blobs;
+	UpdaterFetchPool treepool(client, nconn, batch, sess->m_repopath, blobpool->m_queue.m_policy, blobpool->m_retry, blobpool->m_io);
+	std::unordered_set<oid_t> seen = { tree };
+	std::vector<oid_t> level = { tree };
+	std::vector<std::string> levelpaths = { "" };
+	std::vector<oid_t> blobs;
+
+	while (level.size()) {
+		updater_push_sized(&treepool, client.get(), sess->missing(level));
+		treepool.drain();
 
-	for (const auto &t : tree_lookup_v(repo, trees))
-		for (size_t i = 0; i < git_tree_entrycount(t.get()); ++i)
-			if (git_tree_entry_filemode_bloblike_is(t.get(), i))
-				blobs.push_back(git_bin2hex(*git_tree_entry_id(git_tree_entry_byindex(t.get(), i))));
+		std::vector<oid_t> next, levelblobs;
+		std::vector<std::string> nextpaths, levelblobpaths;
+		const std::vector<unique_ptr_gittree> trees = tree_lookup_v(sess->m_repo.get(), level);
+		for (size_t j = 0; j < trees.size(); j++)
+			for (size_t i = 0; i < git_tree_entrycount(trees[j].get()); ++i) {
+				const git_tree_entry *e = git_tree_entry_byindex(trees[j].get(), i);
+				if (git_tree_entry_filemode(e) != GIT_FILEMODE_TREE && !git_tree_entry_filemode_bloblike_is(trees[j].get(), i))
+					continue;
+				const oid_t obj = git_bin2oidt(*git_tree_entry_id(e));
+				if (!seen.insert(obj).second)
+					continue;
+				const std::string path = (levelpaths[j].empty() ? "" : levelpaths[j] + "/") + git_tree_entry_name(e);
+				if (git_tree_entry_filemode(e) == GIT_FILEMODE_TREE) {
+					next.push_back(obj);
+					nextpaths.push_back(path);
+				}
+				else {
+					levelblobs.push_back(obj);
+					levelblobpaths.push_back(path);
+				}
+			}
+		/* missing returns a sorted subset - pair the paths back up */
+		blobs.insert(blobs.end(), levelblobs.begin(), levelblobs.end());
+		level = std::move(next);
+		levelpaths = std::move(nextpaths);
+		if (!withblobs)
+			continue;
+		std::unordered_map<oid_t, std::string> pathof;
+		for (size_t i = 0; i < levelblobs.size(); i++)
+			pathof[levelblobs[i]] = levelblobpaths[i];
+		const std::vector<oid_t> levelmis = sess->missing(levelblobs);
+		std::vector<std::string> levelmispaths;
+		for (const auto &blob : levelmis)
+			levelmispaths.push_back(pathof[blob]);
+		updater_push_sized(blobpool, client.get(), levelmis, levelmispaths);
+		mis->insert(mis->end(), levelmis.begin(), levelmis.end());
+	}
+
+	treepool.join();
 
 	return blobs;
 }
 
+/* the recorded tree (see updater_checkout_tree_path) if diff and it can be checked out against, with the marker removed either way */
+inline bool
+updater_checkout_baseline(UpdaterSession *sess, const boost::filesystem::path &chkoutdir, bool diff, oid_t *oldtree)
+{
+	const boost::filesystem::path marker = updater_checkout_tree_path(sess);
+	bool incremental = false;
+	if (diff && boost::filesystem::is_regular_file(marker) && boost::filesystem::is_directory(chkoutdir)) {
+		try {
+			*oldtree = oid_t::fromhex(git_refcontent2hex(cruft_file_read(marker)));
+			incremental = sess->exists(*oldtree);
+		}
+		catch (std::exception &) {
+		}
+	}
+	boost::filesystem::remove(marker);
+	return incremental;
+}
+
+/* tree into chkoutdir - diff - only the paths changed since the recorded tree are written (git_checkout_obj_diff)
+   full checkout without a recorded tree (first update, interrupted checkout, checkout directory gone, its objects pruned) or with !diff
+   nthreads above one - files are written by git_checkout_parallel (git_checkout_tree if the tree has symlinks or submodules)
+   fuse - the blobs of the checkout missing from the odb are fetched through it, straight into place (see UpdaterCheckoutSink)
+     keep (paths) excepted - their blobs go to the objects directory, as does everything for trees with symlinks or submodules
+     the rest is written from the odb as with nthreads
+     a fused blob lands in the odb as well - the installed commit stays complete for the haves of the next update */
+inline void
+updater_checkout(UpdaterSession *sess, const oid_t &tree, const boost::filesystem::path &chkoutdir, bool diff, size_t nthreads = 1, UpdaterFetchPool *fuse = nullptr, const std::vector<std::string> &keep = std::vector<std::string>())
+{
+	oid_t oldtree;
+	const bool incremental = updater_checkout_baseline(sess, chkoutdir, diff, &oldtree);
+	bool done = false;
+	if (nthreads > 1 || fuse) {
+		std::vector<GitCheckoutItem> items;
+		std::vector<std::string> removes;
+		if (incremental)
+			git_checkout_items_diff(sess->m_repo.get(), oldtree, tree, &items, &removes);
+		else
+			git_checkout_items_full(sess->m_repo.get(), tree, "", &items);
+		const bool files = git_checkout_items_files_are(items);
+		if (fuse) {
+			std::unordered_map<oid_t, std::vector<GitCheckoutItem> > itemsof;
+			std::vector<oid_t> blobs;
+			for (const auto &item : items) {
+				if (!itemsof.count(item.m_oid))
+					blobs.push_back(item.m_oid);
+				itemsof[item.m_oid].push_back(item);
+			}
+			std::unordered_map<oid_t, std::vector<GitCheckoutItem> > fused;
+			std::vector<oid_t> mis = sess->missing(blobs), loose, fusedmis;
+			for (const auto &blob : mis) {
+				bool kept = !files;
+				for (const auto &item : itemsof[blob])
+					kept = kept || std::find(keep.begin(), keep.end(), item.m_path) != keep.end();
+				if (kept) {
+					loose.push_back(blob);
+				}
+				else {
+					fused[blob] = itemsof[blob];
+					fusedmis.push_back(blob);
+				}
+			}
+			if (files)
+				git_checkout_parallel_prepare(chkoutdir, removes, items);
+			fuse->m_prog->setObjectsList(blobs, mis);
+			fuse->fuse(chkoutdir, fused);
+			std::vector<std::string> fusedpaths;
+			for (const auto &blob : fusedmis)
+				fusedpaths.push_back(fused[blob].front().m_path);
+			updater_push_sized(fuse, fuse->m_client.get(), fusedmis, fusedpaths);
+			updater_push_sized(fuse, fuse->m_client.get(), loose);
+			fuse->join();
+			if (files) {
+				items.erase(std::remove_if(items.begin(), items.end(), [&](const GitCheckoutItem &item) { return fused.count(item.m_oid); }), items.end());
+				git_checkout_parallel_write(sess->m_repo.get(), chkoutdir, items, std::max<size_t>(nthreads, 1));
+				done = true;
+			}
+		}
+		else {
+			done = git_checkout_parallel(sess->m_repo.get(), chkoutdir.string(), removes, items, nthreads);
+		}
+	}
+	if (!done && incremental)
+		git_checkout_obj_diff(sess->m_repo.get(), oldtree, tree, chkoutdir.string());
+	else if (!done)
+		git_checkout_obj(sess->m_repo.get(), tree, chkoutdir.string());
+	cruft_file_write_moving(".git", updater_checkout_tree_path(sess), tree.hex() + "\n");
+}
+
 inline unique_ptr_gitblob
-updater_tree_entry_blob(git_repository *repo, const shahex_t &tree, const std::string &entry)
+updater_tree_entry_blob(git_repository *repo, const oid_t &tree, const std::string &entry)
 {
-	const git_tree_entry *e = git_tree_entry_byname(tree_lookup(repo, git_hex2bin(tree)).get(), entry.c_str());
+	const git_tree_entry *e = git_tree_entry_byname(tree_lookup(repo, git_oidt2bin(tree)).get(), entry.c_str());
 	if (!e || git_tree_entry_filemode(e) != GIT_FILEMODE_BLOB && git_tree_entry_filemode(e) != GIT_FILEMODE_BLOB_EXECUTABLE)
 		throw ConExc();
 	return blob_lookup(repo, *git_tree_entry_id(e));
 }
 
 inline std::string
-updater_tree_entry_blob_content(git_repository *repo, const shahex_t &tree, const std::string &entry)
+updater_tree_entry_blob_content(git_repository *repo, const oid_t &tree, const std::string &entry)
 {
 	unique_ptr_gitblob b(updater_tree_entry_blob(repo, tree, entry));
 	return std::string((const char *)git_blob_rawcontent(b.get()), (size_t)git_blob_rawsize(b.get()));;
 }
 
-inline shahex_t
-updater_commit_create(git_repository *repo, const shahex_t &tree)
+inline oid_t
+updater_commit_create(UpdaterSession *sess, const oid_t &tree)
 {
+	git_repository *repo = sess->m_repo.get();
 	unique_ptr_gitbuf buf(buf_new());
 	git_oid commit_oid_even_if_error = {};
 
-	if (!!git_commit_create_buffer(buf.get(), repo, sig_new_dummy().get(), sig_new_dummy().get(), "UTF-8", "Dummy", tree_lookup(repo, git_hex2bin(tree)).get(), 0, NULL))
+	if (!!git_commit_create_buffer(buf.get(), repo, sig_new_dummy().get(), sig_new_dummy().get(), "UTF-8", "Dummy", tree_lookup(repo, git_oidt2bin(tree)).get(), 0, NULL))
 		throw ConExc();
  
-	if (!!git_odb_write(&commit_oid_even_if_error, odb_from_repo(repo).get(), buf->ptr, buf->size, GIT_OBJ_COMMIT))
-		if (!git_odb_exists(odb_from_repo(repo).get(), &commit_oid_even_if_error))
+	if (!!git_odb_write(&commit_oid_even_if_error, sess->m_odb.get(), buf->ptr, buf->size, GIT_OBJ_COMMIT))
+		if (!git_odb_exists(sess->m_odb.get(), &commit_oid_even_if_error))
 			throw ConExc();
 
-	return git_bin2hex(commit_oid_even_if_error);
+	return git_bin2oidt(commit_oid_even_if_error);
 }
 
 inline boost::filesystem::path
@@ -183,7 +987,7 @@ inline void
 updater_replace_cond(
 	bool arg_skipselfupdate,
 	git_repository *repo,
-	const shahex_t &head,
+	const oid_t &head,
 	const std::string &updatr,
 	const std::string &curexefname,
 	const boost::filesystem::path &stage2path)
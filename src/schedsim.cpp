@@ -0,0 +1,140 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <psmisc.hpp>
+#include <pssched.hpp>
+
+using namespace ps;
+
+/* replays a manifest through each UpdaterSchedPolicy and reports simulated completion times
+     schedsim <manifest> [nconn] [batch] [MiB/s] [latency ms] [large bytes]
+   manifest is the output of 'git ls-tree -r -l <commit>' - every blob is missing and queued up front, in tree order
+   connections share the bandwidth evenly, a batch costs one latency then its objects stream in order (see ConNet pipelining)
+   critical - when both updater.exe and stage2.exe are down, the point self-update can proceed */
+
+class SimConn
+{
+public:
+	double m_latency_end;
+	double m_transferred;
+	/* m_ends[k] - bytes into the batch at which m_batch[k] is complete */
+	std::vector<size_t> m_batch;
+	std::vector<double> m_ends;
+	size_t m_next;
+};
+
+std::vector<UpdaterSchedItem> manifest_read(const std::string &path)
+{
+	std::ifstream ff(path.c_str());
+	if (!ff.good())
+		throw std::runtime_error("manifest read");
+	std::vector<UpdaterSchedItem> items;
+	for (std::string line; std::getline(ff, line);) {
+		/* format: "(mode) (type) (hex) (size)(tab)(path)" */
+		const size_t tab = line.find('\t');
+		if (tab == std::string::npos)
+			continue;
+		std::stringstream ss(line.substr(0, tab));
+		std::string mode, type, hex, size;
+		if (!(ss >> mode >> type >> hex >> size) || type != "blob")
+			continue;
+		items.push_back(UpdaterSchedItem(oid_t::fromhex(hex), std::stoull(size), line.substr(tab + 1)));
+	}
+	return items;
+}
+
+void simulate(const char *name, const sp<UpdaterSchedPolicy> &policy, const std::vector<UpdaterSchedItem> &items, const std::vector<std::string> &critical, size_t nconn, size_t batch, double bw, double latency)
+{
+	UpdaterSchedQueue queue(policy);
+	for (const auto &item : items)
+		queue.push(item);
+	/* queue hands out copies, completion is tracked by index into items - paths are unique */
+	std::unordered_map<std::string, size_t> index;
+	for (size_t i = 0; i < items.size(); i++)
+		index[items[i].m_path] = i;
+	std::vector<double> done(items.size(), -1.0);
+	std::vector<SimConn> conns(nconn);
+
+	double now = 0.0;
+	auto take = [&](SimConn *c) {
+		c->m_batch.clear();
+		c->m_ends.clear();
+		c->m_next = 0;
+		c->m_transferred = 0.0;
+		while (queue.size() && c->m_batch.size() < batch) {
+			const UpdaterSchedItem item = queue.pop();
+			c->m_batch.push_back(index[item.m_path]);
+			c->m_ends.push_back((c->m_ends.size() ? c->m_ends.back() : 0.0) + (double) item.m_size);
+		}
+		c->m_latency_end = now + latency;
+	};
+	for (auto &c : conns)
+		take(&c);
+
+	for (;;) {
+		size_t active = 0;
+		for (const auto &c : conns)
+			if (c.m_batch.size() && c.m_latency_end <= now)
+				active++;
+		const double rate = active ? bw / active : 0.0;
+		double dt = std::numeric_limits<double>::infinity();
+		for (const auto &c : conns) {
+			if (c.m_batch.empty())
+				continue;
+			dt = std::min(dt, c.m_latency_end > now ? c.m_latency_end - now : (c.m_ends[c.m_next] - c.m_transferred) / rate);
+		}
+		if (dt == std::numeric_limits<double>::infinity())
+			break;
+		for (auto &c : conns)
+			if (c.m_batch.size() && c.m_latency_end <= now)
+				c.m_transferred += rate * dt;
+		now += dt;
+		for (auto &c : conns)
+			if (c.m_latency_end - now <= 1e-9)
+				c.m_latency_end = std::min(c.m_latency_end, now);
+		for (auto &c : conns) {
+			if (c.m_batch.empty() || c.m_latency_end > now)
+				continue;
+			while (c.m_next < c.m_batch.size() && c.m_ends[c.m_next] - c.m_transferred <= 1e-6)
+				done[c.m_batch[c.m_next++]] = now;
+			if (c.m_next == c.m_batch.size())
+				take(&c);
+		}
+	}
+
+	double crit = 0.0, mean = 0.0;
+	for (size_t i = 0; i < items.size(); i++) {
+		mean += done[i] / items.size();
+		if (std::find(critical.begin(), critical.end(), items[i].m_path) != critical.end())
+			crit = std::max(crit, done[i]);
+	}
+	std::cout << name << ": total " << now << " s, critical " << crit << " s, mean object " << mean << " s" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2)
+		throw std::runtime_error("usage: schedsim <manifest> [nconn] [batch] [MiB/s] [latency ms] [large bytes]");
+	const size_t nconn = argc > 2 ? std::stoul(argv[2]) : 4;
+	const size_t batch = argc > 3 ? std::stoul(argv[3]) : 8;
+	const double bw = (argc > 4 ? std::stod(argv[4]) : 10.0) * 1024 * 1024;
+	const double latency = (argc > 5 ? std::stod(argv[5]) : 50.0) / 1000;
+	const uint64_t large = argc > 6 ? std::stoull(argv[6]) : 1024 * 1024;
+	const std::vector<std::string> critical = { "updater.exe", "stage2.exe" };
+
+	const std::vector<UpdaterSchedItem> items = manifest_read(argv[1]);
+	std::cout << "objects: " << items.size() << std::endl;
+
+	for (const char *name : { "fifo", "largest", "critical" })
+		simulate(name, updater_sched_policy_create(name, critical, large), items, critical, std::max<size_t>(nconn, 1), std::max<size_t>(batch, 1), bw, latency);
+
+	return EXIT_SUCCESS;
+}
@@ -38,12 +38,9 @@ int main(int argc, char **argv)
 	if (config.get<int>("ARG_TRYOUT"))
 		return 123;
 
-	sp<git_repository> repo(git_repository_ensure(config.get<std::string>("REPO_DIR")));
-
 	client = config.get<std::string>("ARG_FSMODE") != "" ?
 		sp<Con>(new ConFs(config.get<std::string>("ARG_FSMODE"))) :
-		sp<Con>(new ConNet(config.get<std::string>("ORIGIN_DOMAIN_API"), config.get<std::string>("LISTEN_PORT"), ""));
-	client->m_prog.setRepo(repo);
+		con_net_from_config(config);
 
 	sp<Thr> thr(Thr::create(config, client));
 	SfWin win(thr);